@@ -1,16 +1,33 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <iterator>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 using namespace std;
 
 //Structure to store details of a warning
 struct WarningDetails {
-    int position;    // The position (line number or location) where the warning occurred
-    string message;  // The warning message describing the issue
+    int position;         // The position (line number or location) where the warning occurred
+    const char* message;  // The warning message describing the issue (always a string literal)
 
     // Overloading the '<' operator to allow sorting warnings by position (ascending order)
     bool operator< (const WarningDetails &other) {
@@ -20,8 +37,8 @@ struct WarningDetails {
 
 //Structure to store details of an error
 struct ErrorDetails {
-    int position;    // The position (line number or location) where the error occurred
-    string message;  // The error message describing what went wrong
+    int position;         // The position (line number or location) where the error occurred
+    const char* message;  // The error message describing what went wrong (always a string literal)
 
     // Overloading the '<' operator to allow sorting errors by position (ascending order)
     bool operator< (const ErrorDetails &other) {
@@ -29,106 +46,576 @@ struct ErrorDetails {
     }
 };
 
-//Structure to store details for listing file generation
+//Structure to store details for listing file generation; the text is only formatted when the .lst file is written
 struct ListingDetails {
-    string address;      // The address (program counter value) in the listing file
-    string machineCode;  // The corresponding machine code (in hex format)
-    string statement;    // The statement or source code associated with the machine code
+    int lineIndex;  // Index of the source line in lineRecords
+    int wordIndex;  // Index of the generated word in machineCode (-1 if the line generates no code)
 };
 
-//Structure to store details of a program line, associated with the program counter (PC)
-struct LineDetails {
-    int programCounter;   // The program counter value corresponding to this line in the program
-    string label;         // The label associated with the line
-    string instruction;   // The mnemonic/instruction
-    string operand;       // The operand used with the instruction 
-    string previousOperand; // The operand used in the previous instruction (for comparison)
+// Append-only store for text the assembler makes up (numbers converted to decimal, operands rewritten by the
+// optimizer). The views it hands out stay valid as long as the arena does; memory comes in large blocks
+class TextArena {
+public:
+    string_view store(string_view text) {
+        if (text.empty()) return {};
+        if (text.size() > room) {
+            size_t size = max(BLOCK_BYTES, text.size());
+            blocks.emplace_back(new char[size]);
+            next = blocks.back().get();
+            room = size;
+        }
+        memcpy(next, text.data(), text.size());
+        string_view stored(next, text.size());
+        next += text.size();
+        room -= text.size();
+        return stored;
+    }
+    // Take over the blocks of another arena; the views it handed out stay valid
+    void splice(TextArena &other) {
+        move(other.blocks.begin(), other.blocks.end(), back_inserter(blocks));
+        other.blocks.clear();
+        other.room = 0;
+    }
+
+private:
+    static constexpr size_t BLOCK_BYTES = 64 * 1024;
+    vector<unique_ptr<char[]>> blocks;
+    char* next = nullptr;   // Free space of the last block
+    size_t room = 0;
 };
 
-// Containers to store different information related to errors, warnings, lines, and listings
-vector<WarningDetails> warningList;          // List to store all warnings encountered
-vector<ErrorDetails> errorList;              // List to store all errors encountered
-vector<ListingDetails> listingEntries;       // List to store the generated listing file entries
-vector<LineDetails> lineRecords;             // List to store program line information
-vector<std::string> machineCodeList;         // List to store machine codes in 8-bit hexadecimal format
-
-// Function to add a warning to the warning list
-void addWarnings(int location, string message) {
-    warningList.push_back({location, message});  // Add a new warning with its location and message
-}
-
-// Function to add an error to the error list
-void addErrors(int location, string message) {
-    errorList.push_back({location, message});  // Add a new error with its location and message
-}
-
-vector<pair<string, pair<int, int>>> symbolTable;  // {label, {address, lineNum}}
-vector<pair<int, string>> commentLines;            // {line, comment}
-vector<pair<string, pair<string, int>>> opcodeTable;  // {mnemonic, {opcode, operand type}}
-vector<pair<string, vector<int>>> labelReferences;  // {label, {list of line numbers where the label is used}}
-vector<pair<string, string>> variableAssignments;   // {variable(label), associated value}
-
-void fillOpcodeTable() {
-    // third argument if type of operand->
-    //  type 0 : nothing required
-    //  type 1 : value required
-    //  type 2 : offset required
-    opcodeTable = {
-        {"data", {"", 1}}, {"ldc", {"00", 1}}, {"adc", {"01", 1}}, {"ldl", {"02", 2}},
-        {"stl", {"03", 2}}, {"ldnl", {"04", 2}}, {"stnl", {"05", 2}}, {"add", {"06", 0}},
-        {"sub", {"07", 0}}, {"shl", {"08", 0}}, {"shr", {"09", 0}}, {"adj", {"0A", 1}},
-        {"a2sp", {"0B", 0}}, {"sp2a", {"0C", 0}}, {"call", {"0D", 2}}, {"return", {"0E", 0}},
-        {"brz", {"0F", 2}}, {"brlz", {"10", 2}}, {"br", {"11", 2}}, {"HALT", {"12", 0}},
-        {"SET", {"", 1}}
-    };
+// One entry of the symbol table; the label text is stored once, in the table's arena, and referred to by index
+// everywhere else
+struct SymbolEntry {
+    string_view label;       // The label name
+    int address;             // Program counter value of the definition (-1 while only referenced)
+    int lineNum;             // Line where the label was defined (or first referenced)
+    int firstReference;      // First use of the label as an operand, in the table's reference list (-1 if none)
+    int lastReference;       // Last use, where the next one is linked in
+    bool isVariable;         // True if the label was defined by SET
+    string_view value;       // Value assigned by SET (a span of the operand of the SET line)
+};
+
+// Symbol table indexed by an open-addressing hash (linear probing) so lookups do not scan every label
+class SymbolTable {
+public:
+    vector<SymbolEntry> entries;  // All symbols in insertion order
+
+    // FNV-1a hash of the label text; callers may compute it ahead of time (e.g. on another thread)
+    static size_t hashLabel(string_view label) {
+        size_t hash = 2166136261u;
+        for (unsigned char ch : label) {
+            hash = (hash ^ ch) * 16777619u;
+        }
+        return hash;
+    }
+    // Return the index of the label in entries, or -1 if it is not present
+    int find(string_view label) const {
+        return find(label, hashLabel(label));
+    }
+    int find(string_view label, size_t hash) const {
+        if (slots.empty()) return -1;
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; slots[i] != -1; i = (i + 1) & mask) {
+            if (entries[slots[i]].label == label) return slots[i];  // Label found at this slot
+        }
+        return -1;  // Reached an empty slot, so the label was never inserted
+    }
+    // Add a new label (the caller has checked it is not present) and return its index
+    int insert(string_view label, size_t hash, int address, int lineNum) {
+        // Keep the load factor below one half so probe sequences stay short
+        if (2 * (entries.size() + 1) > slots.size()) grow();
+        int index = entries.size();
+        entries.push_back({text.store(label), address, lineNum, -1, -1, false, {}});
+        hashes.push_back(hash);
+        place(index);
+        return index;
+    }
+    // Return the index of the label, inserting it as a placeholder if it has not been seen yet
+    int findOrInsert(string_view label, size_t hash, int address, int lineNum) {
+        int index = find(label, hash);
+        return index != -1 ? index : insert(label, hash, address, lineNum);
+    }
+    // Make room for count symbols so inserting them never grows the table
+    void reserve(size_t count) {
+        entries.reserve(count);
+        hashes.reserve(count);
+        size_t size = 16;
+        while (size < 2 * (count + 1)) size *= 2;
+        if (size > slots.size()) {
+            slots.assign(size, -1);
+            for (int i = 0; i < (int)entries.size(); ++i) place(i);
+        }
+    }
+    SymbolEntry& operator[](int index) { return entries[index]; }
+    // Record that the label at index is used as an operand on the given line
+    void addReference(int index, int line) {
+        int reference = referenceLine.size();
+        referenceLine.push_back(line);
+        referenceNext.push_back(-1);
+        SymbolEntry &entry = entries[index];
+        if (entry.firstReference == -1) entry.firstReference = reference;
+        else referenceNext[entry.lastReference] = reference;
+        entry.lastReference = reference;
+    }
+    // Line of the first use of the label at index (-1 if it is not used)
+    int firstReferenceLine(int index) const {
+        int reference = entries[index].firstReference;
+        return reference == -1 ? -1 : referenceLine[reference];
+    }
+    // Call f with every line the label at index is used on, in the order they were added
+    template <class F> void forEachReference(int index, F f) const {
+        for (int reference = entries[index].firstReference; reference != -1; reference = referenceNext[reference]) {
+            f(referenceLine[reference]);
+        }
+    }
+
+private:
+    vector<int> slots;       // Indices into entries, -1 marks an empty slot; size is always a power of two
+    vector<size_t> hashes;   // Hash of each entry, so growing the table does not rehash the text
+    TextArena text;          // Text of the labels
+    vector<int> referenceLine, referenceNext;  // Uses of all labels: line number and the label's next use (-1 if last)
+
+    // Put entries[index] into the first free slot of its probe sequence
+    void place(int index) {
+        size_t mask = slots.size() - 1;
+        size_t i = hashes[index] & mask;
+        while (slots[i] != -1) i = (i + 1) & mask;
+        slots[i] = index;
+    }
+    // Double the slot array and re-insert every entry
+    void grow() {
+        slots.assign(max<size_t>(16, slots.size() * 2), -1);
+        for (int i = 0; i < (int)entries.size(); ++i) place(i);
+    }
+};
+
+// Details of a mnemonic: its opcode and the type of operand it takes
+//  type 0 : nothing required
+//  type 1 : value required
+//  type 2 : offset required
+struct OpcodeInfo {
+    const char* mnemonic;  // Mnemonic as written in the source
+    int opcode;            // Opcode value (-1 for directives)
+    int type;              // Operand type (see above)
+};
+
+constexpr OpcodeInfo opcodeTable[] = {
+    {"data", -1, 1}, {"ldc", 0x00, 1}, {"adc", 0x01, 1}, {"ldl", 0x02, 2},
+    {"stl", 0x03, 2}, {"ldnl", 0x04, 2}, {"stnl", 0x05, 2}, {"add", 0x06, 0},
+    {"sub", 0x07, 0}, {"shl", 0x08, 0}, {"shr", 0x09, 0}, {"adj", 0x0A, 1},
+    {"a2sp", 0x0B, 0}, {"sp2a", 0x0C, 0}, {"call", 0x0D, 2}, {"return", 0x0E, 0},
+    {"brz", 0x0F, 2}, {"brlz", 0x10, 2}, {"br", 0x11, 2}, {"HALT", 0x12, 0},
+    {"SET", -1, 1}
+};
+constexpr int OPCODE_COUNT = sizeof(opcodeTable) / sizeof(opcodeTable[0]);
+
+// Perfect hash over the mnemonics above: the first two characters, the last one and the length
+// are enough to give every mnemonic its own slot
+constexpr int MNEMONIC_SLOTS = 32;
+constexpr unsigned mnemonicHash(const char* name, size_t len) {
+    return (name[0] * 9u + name[1] * 27u + name[len - 1] * 29u + len) % MNEMONIC_SLOTS;
+}
+constexpr size_t constLength(const char* text) {
+    size_t len = 0;
+    while (text[len] != '\0') ++len;
+    return len;
+}
+
+// Slot -> index into opcodeTable (-1 for unused slots), built at compile time
+struct MnemonicSlots {
+    int index[MNEMONIC_SLOTS];
+};
+constexpr MnemonicSlots buildMnemonicSlots() {
+    MnemonicSlots table{};
+    for (int i = 0; i < MNEMONIC_SLOTS; ++i) table.index[i] = -1;
+    for (int i = 0; i < OPCODE_COUNT; ++i) {
+        table.index[mnemonicHash(opcodeTable[i].mnemonic, constLength(opcodeTable[i].mnemonic))] = i;
+    }
+    return table;
+}
+constexpr MnemonicSlots mnemonicSlots = buildMnemonicSlots();
+
+// Every mnemonic must land in a distinct slot, otherwise one of them would be lost
+constexpr bool mnemonicHashIsPerfect() {
+    for (int i = 0; i < OPCODE_COUNT; ++i) {
+        const char* name = opcodeTable[i].mnemonic;
+        if (mnemonicSlots.index[mnemonicHash(name, constLength(name))] != i) return false;
+    }
+    return true;
+}
+static_assert(mnemonicHashIsPerfect(), "mnemonic hash has a collision");
+
+// findMnemonic turns away shorter words before hashing them
+constexpr bool mnemonicsHaveTwoCharacters() {
+    for (int i = 0; i < OPCODE_COUNT; ++i) {
+        if (constLength(opcodeTable[i].mnemonic) < 2) return false;
+    }
+    return true;
 }
+static_assert(mnemonicsHaveTwoCharacters(), "a mnemonic is shorter than the hash reads");
+
+// Look up a mnemonic; returns nullptr if it is not part of the instruction set
+const OpcodeInfo* findMnemonic(string_view name) {
+    // The hash reads two leading characters, and a view is not NUL-terminated; no mnemonic is shorter anyway
+    if (name.size() < 2) return nullptr;
+    int index = mnemonicSlots.index[mnemonicHash(name.data(), name.size())];
+    if (index == -1 || name != opcodeTable[index].mnemonic) return nullptr;
+    return &opcodeTable[index];
+}
+
+// Index of a mnemonic in opcodeTable, the ID line records keep instead of its text (-1 if it is not one)
+int mnemonicId(string_view name) {
+    const OpcodeInfo* info = findMnemonic(name);
+    return info ? info - opcodeTable : -1;
+}
+
+// stoi and stoll for spans, which are not NUL-terminated; numbers are short enough to stay in the string itself
+inline int toInt(string_view text) {
+    return stoi(string(text));
+}
+inline long long toLong(string_view text) {
+    return stoll(string(text));
+}
+
+// Records of the program's statements, one array per field so each pass only streams through the fields
+// it uses. A record owns no memory: text fields are spans of the source file, the cache file or the job's
+// TextArena, the mnemonic is an index into opcodeTable and an operand label an index into the symbol table
+struct LineRecords {
+    vector<int> programCounter;            // The program counter value corresponding to this line in the program
+    vector<string_view> label;             // The label associated with the line (without ':')
+    vector<int> mnemonic;                  // Index of the mnemonic in opcodeTable (-1 if the line has none)
+    vector<string_view> operand;           // The operand, with numbers converted to decimal
+    vector<string_view> previousOperand;   // The operand as written in the source
+    vector<int> lineNum;                   // Line number in the source file
+    vector<int> symbolIndex;               // Index of the operand label in symbolTable (-1 if the operand is not a label)
+
+    size_t size() const { return programCounter.size(); }
+    const OpcodeInfo* info(size_t r) const { return mnemonic[r] == -1 ? nullptr : &opcodeTable[mnemonic[r]]; }
+    string_view instruction(size_t r) const { return mnemonic[r] == -1 ? "" : opcodeTable[mnemonic[r]].mnemonic; }
+    void push_back(int pc, string_view lineLabel, int id, string_view lineOperand, string_view written, int line) {
+        programCounter.push_back(pc);
+        label.push_back(lineLabel);
+        mnemonic.push_back(id);
+        operand.push_back(lineOperand);
+        previousOperand.push_back(written);
+        lineNum.push_back(line);
+        symbolIndex.push_back(-1);
+    }
+    void reserve(size_t count) {
+        forEachField([count](auto &field) { field.reserve(count); });
+    }
+    void resize(size_t count) {
+        forEachField([count](auto &field) { field.resize(count); });
+    }
+    // Copy the records of other to [at, at + other.size())
+    void place(size_t at, const LineRecords &other) {
+        copy(other.programCounter.begin(), other.programCounter.end(), programCounter.begin() + at);
+        copy(other.label.begin(), other.label.end(), label.begin() + at);
+        copy(other.mnemonic.begin(), other.mnemonic.end(), mnemonic.begin() + at);
+        copy(other.operand.begin(), other.operand.end(), operand.begin() + at);
+        copy(other.previousOperand.begin(), other.previousOperand.end(), previousOperand.begin() + at);
+        copy(other.lineNum.begin(), other.lineNum.end(), lineNum.begin() + at);
+        copy(other.symbolIndex.begin(), other.symbolIndex.end(), symbolIndex.begin() + at);
+    }
+    // Concatenate the records of parts, in order, into this (empty) set. The fields are gathered one at a time
+    // and each part's copy is released right away, so at most one field is ever held twice
+    void gather(const vector<LineRecords*> &parts) {
+        gatherField(parts, &LineRecords::programCounter);
+        gatherField(parts, &LineRecords::label);
+        gatherField(parts, &LineRecords::mnemonic);
+        gatherField(parts, &LineRecords::operand);
+        gatherField(parts, &LineRecords::previousOperand);
+        gatherField(parts, &LineRecords::lineNum);
+        gatherField(parts, &LineRecords::symbolIndex);
+    }
 
-vector<string> parseLine(string currentLine, int locationCounter) {  
-    // If the line is empty, return an empty vector as no information can be extracted
-    if (currentLine.empty()) return {};
-    vector<string> result;  // This will hold the parsed words
-    stringstream now(currentLine);  // Stringstream to extract words from the line
-    string word;
-    // Process each word in the current line
-    while (now >> word) {
-        if (word.empty()) continue;  // Skip empty words (spaces or tabs)
+private:
+    template <class T> void gatherField(const vector<LineRecords*> &parts, vector<T> LineRecords::*field) {
+        size_t count = 0;
+        for (LineRecords* part : parts) count += (part->*field).size();
+        (this->*field).reserve(count);
+        for (LineRecords* part : parts) {
+            (this->*field).insert((this->*field).end(), (part->*field).begin(), (part->*field).end());
+            vector<T>().swap(part->*field);
+        }
+    }
+    template <class F> void forEachField(F f) {
+        f(programCounter);
+        f(label);
+        f(mnemonic);
+        f(operand);
+        f(previousOperand);
+        f(lineNum);
+        f(symbolIndex);
+    }
+};
+
+// Tokens of one source line; the views point into the mapped source file, so nothing is copied
+struct LineTokens {
+    string_view token[3];  // The first three words of the statement (label, mnemonic, operand when present)
+    int count;             // Total number of words in the statement
+    string_view comment;   // Text after the first ';' with leading spaces skipped (empty if none)
+};
+
+// The scanner works on bit masks: bit i of a mask describes byte i of the text, so the next word, ':' or ';'
+// is found with a count-trailing-zeros instead of a loop over characters. The masks are built 32 (AVX2) or
+// 16 (SSE2) bytes at a time when the processor has them, else a byte at a time; the choice is made once at
+// start-up. Build with -DASM_NO_SIMD to use the byte loop everywhere
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(ASM_NO_SIMD)
+#define ASM_SIMD 1
+#endif
+
+// Whitespace as understood by stream extraction (space, tab, newline, vertical tab, form feed, carriage return)
+inline bool isBlank(char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+// Classes a token can belong to (a token can be in several, e.g. "017" is octal and decimal)
+enum TokenClass {
+    TOKEN_LABEL = 1,        // Starts with a letter, then letters, digits and '_'
+    TOKEN_DECIMAL = 2,      // Only digits (an empty token counts, as it always has)
+    TOKEN_OCTAL = 4,        // '0' followed by at least one digit 0-7
+    TOKEN_HEXADECIMAL = 8   // "0x" or "0X" followed by at least one hexadecimal digit
+};
+
+// One way of building the masks; all of them give the same results
+struct ScanImplementation {
+    const char* name;
+    // Set bit i of blank/colon/semicolon for byte i of p[0, len); the arrays hold (len + 63) / 64 words
+    void (*scanLine)(const char* p, size_t len, uint64_t* blank, uint64_t* colon, uint64_t* semicolon);
+    // The TokenClass bits of the token p[0, len)
+    int (*classifyToken)(const char* p, size_t len);
+};
+
+void scanLineBytes(const char* p, size_t len, uint64_t* blank, uint64_t* colon, uint64_t* semicolon) {
+    size_t words = (len + 63) / 64;
+    fill(blank, blank + words, 0);
+    fill(colon, colon + words, 0);
+    fill(semicolon, semicolon + words, 0);
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t bit = 1ull << (i & 63);
+        if (isBlank(p[i])) blank[i >> 6] |= bit;
+        if (p[i] == ':') colon[i >> 6] |= bit;
+        if (p[i] == ';') semicolon[i >> 6] |= bit;
+    }
+}
+
+// Combine the per-character checks of a token into its classes; `digits` etc. say whether every character
+// (for hexDigits: every character after the "0x") passed the check
+inline int tokenClasses(const char* p, size_t len, bool labelChars, bool digits, bool octalDigits, bool hexDigits) {
+    int classes = 0;
+    if (len > 0 && ((p[0] | 0x20) >= 'a' && (p[0] | 0x20) <= 'z') && labelChars) classes |= TOKEN_LABEL;
+    if (digits) classes |= TOKEN_DECIMAL;
+    if (len >= 2 && p[0] == '0' && octalDigits) classes |= TOKEN_OCTAL;
+    if (len >= 3 && p[0] == '0' && (p[1] | 0x20) == 'x' && hexDigits) classes |= TOKEN_HEXADECIMAL;
+    return classes;
+}
+
+int classifyTokenBytes(const char* p, size_t len) {
+    bool labelChars = true, digits = true, octalDigits = true, hexDigits = true;
+    for (size_t i = 0; i < len; ++i) {
+        char ch = p[i], lower = ch | 0x20;
+        bool digit = ch >= '0' && ch <= '9';
+        labelChars &= digit || (lower >= 'a' && lower <= 'z') || ch == '_';
+        digits &= digit;
+        octalDigits &= ch >= '0' && ch <= '7';
+        if (i >= 2) hexDigits &= digit || (lower >= 'a' && lower <= 'f');
+    }
+    return tokenClasses(p, len, labelChars, digits, octalDigits, hexDigits);
+}
+
+#ifdef ASM_SIMD
+// Copy the `width` bytes at p to `out` when fewer than that remain in the text. Reading past the end is
+// harmless while the read stays in the page of p (the extra bits are ignored), so only reads that cross
+// into the next page go through a zero-padded copy
+inline const char* safeBlock(const char* p, size_t remaining, size_t width, char* out) {
+    if (remaining >= width || ((uintptr_t)p & 4095) <= 4096 - width) return p;
+    memset(out, 0, width);
+    memcpy(out, p, remaining);
+    return out;
+}
+
+// Bytes of x (unsigned) in [low, low + span]
+inline __m128i inRange16(__m128i x, char low, char span) {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(span)), shifted);
+}
+
+void scanLineSSE2(const char* p, size_t len, uint64_t* blank, uint64_t* colon, uint64_t* semicolon) {
+    size_t words = (len + 63) / 64;
+    fill(blank, blank + words, 0);
+    fill(colon, colon + words, 0);
+    fill(semicolon, semicolon + words, 0);
+    alignas(16) char padded[16];
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)safeBlock(p + i, len - i, 16, padded));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), inRange16(x, '\t', 4));
+        int shift = i & 63;
+        blank[i >> 6] |= (uint64_t)(unsigned)_mm_movemask_epi8(space) << shift;
+        colon[i >> 6] |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(':'))) << shift;
+        semicolon[i >> 6] |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(';'))) << shift;
+    }
+}
+
+int classifyTokenSSE2(const char* p, size_t len) {
+    unsigned labelChars = 0, digits = 0, octalDigits = 0, hexDigits = 0;  // Bits of characters that fail
+    alignas(16) char padded[16];
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)safeBlock(p + i, len - i, 16, padded));
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i digit = inRange16(x, '0', 9);
+        __m128i hex = _mm_or_si128(digit, inRange16(lower, 'a', 5));
+        __m128i label = _mm_or_si128(_mm_or_si128(digit, inRange16(lower, 'a', 25)), _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        unsigned valid = len - i >= 16 ? 0xFFFF : (1u << (len - i)) - 1;
+        labelChars |= ~_mm_movemask_epi8(label) & valid;
+        digits |= ~_mm_movemask_epi8(digit) & valid;
+        octalDigits |= ~_mm_movemask_epi8(inRange16(x, '0', 7)) & valid;
+        hexDigits |= ~_mm_movemask_epi8(hex) & valid & (i ? 0xFFFF : 0xFFFC);
+    }
+    return tokenClasses(p, len, !labelChars, !digits, !octalDigits, !hexDigits);
+}
+
+__attribute__((target("avx2"))) inline __m256i inRange32(__m256i x, char low, char span) {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(span)), shifted);
+}
+
+__attribute__((target("avx2"))) void scanLineAVX2(const char* p, size_t len, uint64_t* blank, uint64_t* colon, uint64_t* semicolon) {
+    size_t words = (len + 63) / 64;
+    fill(blank, blank + words, 0);
+    fill(colon, colon + words, 0);
+    fill(semicolon, semicolon + words, 0);
+    alignas(32) char padded[32];
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)safeBlock(p + i, len - i, 32, padded));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), inRange32(x, '\t', 4));
+        int shift = i & 63;
+        blank[i >> 6] |= (uint64_t)(unsigned)_mm256_movemask_epi8(space) << shift;
+        colon[i >> 6] |= (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(':'))) << shift;
+        semicolon[i >> 6] |= (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(';'))) << shift;
+    }
+}
+
+__attribute__((target("avx2"))) int classifyTokenAVX2(const char* p, size_t len) {
+    unsigned labelChars = 0, digits = 0, octalDigits = 0, hexDigits = 0;  // Bits of characters that fail
+    alignas(32) char padded[32];
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)safeBlock(p + i, len - i, 32, padded));
+        __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        __m256i digit = inRange32(x, '0', 9);
+        __m256i hex = _mm256_or_si256(digit, inRange32(lower, 'a', 5));
+        __m256i label = _mm256_or_si256(_mm256_or_si256(digit, inRange32(lower, 'a', 25)), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+        unsigned valid = len - i >= 32 ? 0xFFFFFFFFu : (1u << (len - i)) - 1;
+        labelChars |= ~(unsigned)_mm256_movemask_epi8(label) & valid;
+        digits |= ~(unsigned)_mm256_movemask_epi8(digit) & valid;
+        octalDigits |= ~(unsigned)_mm256_movemask_epi8(inRange32(x, '0', 7)) & valid;
+        hexDigits |= ~(unsigned)_mm256_movemask_epi8(hex) & valid & (i ? 0xFFFFFFFFu : 0xFFFFFFFCu);
+    }
+    return tokenClasses(p, len, !labelChars, !digits, !octalDigits, !hexDigits);
+}
+#endif
+
+// Every implementation this build has, from bytes to the widest vectors
+const ScanImplementation scanImplementations[] = {
+    {"bytes", scanLineBytes, classifyTokenBytes},
+#ifdef ASM_SIMD
+    {"sse2", scanLineSSE2, classifyTokenSSE2},
+    {"avx2", scanLineAVX2, classifyTokenAVX2},
+#endif
+};
+
+// Whether the processor has the instructions the implementation needs
+bool scannerSupported(const ScanImplementation &implementation) {
+#ifdef ASM_SIMD
+    __builtin_cpu_init();
+    if (&implementation == &scanImplementations[1]) return __builtin_cpu_supports("sse2");
+    if (&implementation == &scanImplementations[2]) return __builtin_cpu_supports("avx2");
+#endif
+    return true;
+}
+
+// SSE2 whenever the processor has it, even with AVX2: statement lines are short (under 30 bytes on average),
+// and on them AVX2 measures no faster, sometimes slower ("asm --scan-bench" times both)
+const ScanImplementation* selectScanner() {
+#ifdef ASM_SIMD
+    if (scannerSupported(scanImplementations[1])) return &scanImplementations[1];
+#endif
+    return &scanImplementations[0];
+}
+
+const ScanImplementation* scanner = selectScanner();
+
+inline int classifyToken(string_view token) {
+    return scanner->classifyToken(token.data(), token.size());
+}
+
+// Position of the first bit at or after pos that is set in mask (clear, if flip is all ones), or limit if there is none
+inline size_t nextBit(const uint64_t* mask, uint64_t flip, size_t pos, size_t limit) {
+    if (pos >= limit) return limit;
+    size_t word = pos >> 6;
+    uint64_t bits = (mask[word] ^ flip) & (~0ull << (pos & 63));
+    while (!bits) {
+        if (++word * 64 >= limit) return limit;
+        bits = mask[word] ^ flip;
+    }
+    return min(limit, word * 64 + __builtin_ctzll(bits));
+}
+
+// Lines up to this long keep their masks on the stack
+const size_t SCAN_STACK_BYTES = 256;
+
+// Split a line into words in a single scan, handling the same quirks as before:
+// "label:instr" written without a space is split after the ':' and a ';' glued to the end of a word ends the statement
+void tokenizeLine(string_view line, LineTokens &result) {
+    result.count = 0;
+    result.comment = {};
+    auto addToken = [&result](string_view word) {
+        if (result.count < 3) result.token[result.count] = word;
+        ++result.count;
+    };
+    size_t len = line.size(), words = (len + 63) / 64;
+    uint64_t stackMasks[3 * SCAN_STACK_BYTES / 64];
+    vector<uint64_t> longMasks;
+    uint64_t* blank = stackMasks;
+    if (words > SCAN_STACK_BYTES / 64) {
+        longMasks.resize(3 * words);
+        blank = longMasks.data();
+    }
+    uint64_t* colon = blank + words;
+    uint64_t* semicolon = colon + words;
+    scanner->scanLine(line.data(), len, blank, colon, semicolon);
+    size_t pos = 0;
+    while (true) {
+        // Skip the whitespace before the next word
+        pos = nextBit(blank, ~0ull, pos, len);
+        if (pos == len) break;
+        size_t start = pos;
+        pos = nextBit(blank, 0, pos, len);
+        string_view word = line.substr(start, pos - start);
         // If a comment (denoted by ';') is encountered, stop processing further words
         if (word[0] == ';') break;
-        // Check if the word contains a ':' and handle the case where ':' is not properly separated from the statement
-        auto i = word.find(':');
-        if (i != string::npos && word.back() != ':') {  
-            result.push_back(word.substr(0, i + 1));  // Add the part before ':' to result
-            word = word.substr(i + 1);  // Update the word by removing the part before ':'
+        // Handle the case where ':' is not properly separated from the statement
+        size_t colonPos = nextBit(colon, 0, start, pos);
+        if (colonPos != pos && word.back() != ':') {
+            addToken(word.substr(0, colonPos - start + 1));  // Add the part up to and including ':'
+            word.remove_prefix(colonPos - start + 1);        // Keep processing the rest of the word
         }
         // Handle case where ';' is attached directly to the word, without space
-        if (word.back() == ';') {  
-            word.pop_back();  // Remove the trailing ';'
-            result.push_back(word);  // Add the word without ';'
-            break;  // End parsing as the line likely ends with a statement followed by ';'
-        }
-        result.push_back(word);  // Add the word to the result if it doesn’t end with a semicolon
-    }
-    // Initialize a string to store the comment (if any)
-    string comment = "";
-    // Look for the comment in the line, denoted by ';' and extract everything after it
-    for (int i = 0; i < (int)currentLine.size(); ++i) {
-        if (currentLine[i] == ';') {
-            int j = i + 1;  // Start from the character after ';'
-            // Skip any leading spaces after the semicolon
-            while (j < currentLine.size() && currentLine[j] == ' ') ++j;
-
-            // Append remaining characters to comment string
-            for (; j < currentLine.size(); ++j) {
-                comment += currentLine[j];
-            }
-            break;  // Stop once the comment is fully extracted
+        if (word.back() == ';') {
+            word.remove_suffix(1);
+            addToken(word);
+            break;  // The rest of the line is a comment
         }
+        addToken(word);
     }
-    // If a comment is found, store it as a pair (line number, comment) in commentLines
-    if (!comment.empty()) {
-        commentLines.push_back({locationCounter, comment});
+    // Look for the comment in the line, denoted by ';', and skip any leading spaces after it
+    size_t semicolonPos = nextBit(semicolon, 0, 0, len);
+    if (semicolonPos != len) {
+        size_t begin = semicolonPos + 1;
+        while (begin < len && line[begin] == ' ') ++begin;
+        result.comment = line.substr(begin);
     }
-    return result;  // Return the parsed words
 }
 
 
@@ -140,51 +627,25 @@ public:
     }
     // Check if the character is an alphabet (a-z or A-Z)
     bool isAlphabet(char ch) {
-        char lowerCh = tolower(ch);  // Convert character to lowercase to handle both upper and lowercase letters
+        char lowerCh = ch | 0x20;  // Setting bit 5 lowercases a letter (and maps no other character into a-z)
         return lowerCh >= 'a' && lowerCh <= 'z';  // Checks if the character is between 'a' and 'z'
     }
     // Validate if the label is correct
     // A valid label must start with an alphabet and can contain digits, alphabets, and underscores
-    bool isValidLabel(string label) {  
-        bool valid = true;
-        // The first character must be an alphabet
-        valid &= isAlphabet(label[0]);
-        // Every character in the label must be either a digit, alphabet, or an underscore
-        for (char ch : label) {
-            valid &= (isDigit(ch) || isAlphabet(ch) || (ch == '_'));
-        }
-        
-        return valid;  // Return whether the label is valid
+    bool isValidLabel(string_view label) {
+        return classifyToken(label) & TOKEN_LABEL;
     }
     // Check if the string represents a decimal number (all characters should be digits)
-    bool isDecimal(string number) {
-        bool valid = true;
-        for (char ch : number) {
-            valid &= isDigit(ch);  // Check if each character is a digit
-        }
-        return valid;  // Return whether the number is a valid decimal
+    bool isDecimal(string_view number) {
+        return classifyToken(number) & TOKEN_DECIMAL;
     }
     // Check if the string represents an octal number (starts with '0' and contains digits between 0-7)
-    bool isOctal(string number) {
-        bool valid = true;
-        // The number should be at least two characters long and start with '0'
-        valid &= (number.size() >= 2 && number[0] == '0');
-        // Every character in the number should be between '0' and '7'
-        for (char ch : number) {
-            valid &= (ch >= '0' && ch <= '7');
-        }
-        return valid;  // Return whether the number is a valid octal
+    bool isOctal(string_view number) {
+        return classifyToken(number) & TOKEN_OCTAL;
     }
     // Check if the string represents a hexadecimal number (starts with '0x' and contains valid hexadecimal characters)
-    bool isHexadecimal(string number) {
-        bool valid = true;        
-        // The number should be at least 3 characters long and start with "0x"
-        valid &= (number.size() >= 3 && number[0] == '0' && tolower(number[1]) == 'x');
-        // Every character in the number after "0x" should be either a digit or a valid hexadecimal character (a-f or A-F)
-        for (int i = 2; i < number.size(); ++i) {
-            valid &= isDigit(number[i]) || (tolower(number[i]) >= 'a' && tolower(number[i]) <= 'f');
-        }
-        return valid;  // Return whether the number is a valid hexadecimal
+    bool isHexadecimal(string_view number) {
+        return classifyToken(number) & TOKEN_HEXADECIMAL;
     }
 };
 Validator validator;
@@ -213,136 +674,62 @@ public:
         // Return the result as a string
         return to_string(result);
     }
-    // Convert decimal to 8-bit hexadecimal string
-    string decToHex(int num) {
-        unsigned int number = num;
-        string result = "";
-        // Convert the decimal number to hexadecimal (8 bits)
-        for (int i = 0; i < 8; ++i, number /= 16) {
-            // Find the remainder when divided by 16 (hexadecimal digits)
-            int remainder = number % 16;
-            
-            // If the remainder is 0-9, convert it to the character '0'-'9'
-            // If the remainder is 10-15, convert it to the character 'A'-'F'
-            result += (remainder <= 9 ? char(remainder + '0') : char(remainder - 10) + 'A');
-        }
-        // Reverse the result string as the conversion gives the hexadecimal digits in reverse order
-        reverse(result.begin(), result.end());
-        // Return the 8-bit hexadecimal string
-        return result;
-    }
 };
 
 Converter converter;
 
-// Process labels and check for errors
-void LabelProcessor(string label, int location_counter, int program_counter) {
-    // If the label is empty, return immediately as there's nothing to process
-    if (label.empty()) return;
-    // Validate the label using the Validator class (check if it's a valid label)
-    bool isValid = validator.isValidLabel(label);
-    if (!isValid) {
-        // If the label is not valid, report an error with the location counter
-        addErrors(location_counter, "Bogus Label name");
-    } else {
-        bool labelExists = false;
-        // Check if the label already exists in the symbol table
-        for (auto &entry : symbolTable) {
-            if (entry.first == label) {  // If the label is found in the symbol table
-                if (entry.second.first != -1) {
-                    // If the label already has a valid program counter, it's a duplicate definition
-                    addErrors(location_counter, "Duplicate label definition");
-                    labelExists = true;
-                } else {
-                    // If the label exists but hasn't been defined yet, update its program counter and location counter
-                    entry.second = {program_counter, location_counter};
-                }
-                break;  // Exit the loop once the label is found and processed
-            }
-        }
-        // If the label wasn't found in the symbol table, add a new entry with the label, program counter, and location counter
-        if (!labelExists) {
-            symbolTable.push_back({label, {program_counter, location_counter}});
-        }
-    }
-}
-
-string OperandProcessor(string operand, int location_counter) {
-    string result = "";  // Initialize the return string which will store the processed operand
-    // Check if the operand is a valid label using the Validator class
-    if (validator.isValidLabel(operand)) {
-        bool labelFound = false;
-        // Search if the label already exists in labelReferences
-        for (auto &entry : labelReferences) {
-            if (entry.first == operand) {
-                // If the label is found, append the current location counter to its reference list
-                entry.second.push_back(location_counter);
-                labelFound = true;
-                break;  // Exit the loop once the label is found
-            }
-        }
-        // If the label was not found in labelReferences, add a new entry for it
-        if (!labelFound) {
-            labelReferences.push_back({operand, {location_counter}});
-        }
-        bool labelExists = false;
-        // Check if the operand (label) already exists in the symbol table
-        for (auto &entry : symbolTable) {
-            if (entry.first == operand) {
-                labelExists = true;
-                break;  // Exit the loop once the label is found in the symbol table
-            }
-        }
-        // If the operand (label) is not found in symbolTable, add it with a placeholder (-1 program counter)
-        if (!labelExists) {
-            symbolTable.push_back({operand, {-1, location_counter}});  // Label is used but not yet defined
-        }
+// Check an operand: labels are returned as they are (isLabel is set), numbers are converted to decimal (the
+// converted text goes to text; a decimal operand is returned as it is). Returns an empty span if the operand is neither
+string_view OperandProcessor(string_view operand, bool &isLabel, TextArena &text) {
+    // Check if the operand is a valid label; one scan of the operand gives every class it belongs to
+    int classes = classifyToken(operand);
+    isLabel = classes & TOKEN_LABEL;
+    if (isLabel) {
         // Return the operand as is if it's a valid label
         return operand;
     }
     // If the operand is not a valid label, process it as a numeric value (octal, hexadecimal, or decimal)
-    string now = operand, sign = "";
+    string_view now = operand, sign = "";
     // Handle the case where the operand has a sign (+ or -)
     if (now[0] == '-' or now[0] == '+') {
-        sign = now[0];  // Store the sign
+        sign = now.substr(0, 1);  // Store the sign
         now = now.substr(1);  // Remove the sign from the operand for further processing
+        classes = classifyToken(now);
     }
-    result += sign;  // Add the sign back to the result
     // Handle different operand formats: Octal, Hexadecimal, and Decimal
-    if (validator.isOctal(now)) {
-        // If the operand is in octal, convert it to decimal (removing the leading '0')
-        result += converter.octalToDec(now.substr(1));
-    } else if (validator.isHexadecimal(now)) {
-        // If the operand is in hexadecimal, convert it to decimal (removing the leading '0x')
-        result += converter.hexToDec(now.substr(2));
-    } else if (validator.isDecimal(now)) {
-        // If the operand is already a decimal number, simply return it as a string
-        result=result+now;
-    } else {
-        // If the operand format is invalid, return an empty string
-        result = "";
+    if (classes & TOKEN_OCTAL) {
+        // If the operand is in octal, convert it to decimal (removing the leading '0') and add the sign back
+        return text.store(string(sign) + converter.octalToDec(string(now.substr(1))));
+    } else if (classes & TOKEN_HEXADECIMAL) {
+        // If the operand is in hexadecimal, convert it to decimal (removing the leading '0x') and add the sign back
+        return text.store(string(sign) + converter.hexToDec(string(now.substr(2))));
+    } else if (classes & TOKEN_DECIMAL) {
+        // If the operand is already a decimal number (sign included), it is its own result
+        return operand;
     }
-    return result;  // Return the processed operand (or an empty string if invalid)
+    // If the operand format is invalid, return an empty span
+    return {};
 }
 
 
-//Finding errors related to Mnemonics
-void MnemonicProcessor(string instruction_name, string &operand, int location_counter, int program_counter, int rem, bool &flag) {
+// Whether a decimal operand (sign included) is a number that fits an int, as the second pass converts it
+bool fitsInt(string_view text) {
+    if (!text.empty() && text[0] == '+') text.remove_prefix(1);
+    int value;
+    from_chars_result result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+//Finding errors related to Mnemonics; errors go to the given list so lines can be checked independently
+void MnemonicProcessor(string_view instruction_name, string_view &operand, int location_counter, int rem, bool &flag, bool &operandIsLabel, vector<ErrorDetails> &errors, TextArena &text) {
     if (instruction_name.empty()) return;  // If the instruction name is empty, there is nothing to process
-    bool foundMnemonic = false;  // Flag to check if the mnemonic is found in the opcode table
-    int type = -1;  // Variable to store the type of the mnemonic (used to decide operand handling)
-    // Searching for the instruction name (mnemonic) in the opcodeTable
-    for (const auto &entry : opcodeTable) {
-        if (entry.first == instruction_name) {  // If the mnemonic is found
-            foundMnemonic = true;  // Mark the mnemonic as found
-            type = entry.second.second;  // Get the type of the mnemonic (based on the second pair in the entry)
-            break;  // Exit the loop once the mnemonic is found
-        }
-    }
+    // Look up the instruction name (mnemonic) in the opcode table
+    const OpcodeInfo* info = findMnemonic(instruction_name);
+    int type = info ? info->type : -1;  // Type of the mnemonic (used to decide operand handling)
 
     // If the mnemonic is not found in the opcode table, log an error for the location
-    if (!foundMnemonic) {
-        addErrors(location_counter, "Bogus Mnemonic");
+    if (!info) {
+        errors.push_back({location_counter, "Bogus Mnemonic"});
     } else {
         // Check if the operand is present
         int isOp = !operand.empty();  // Boolean flag to check if the operand is not empty
@@ -350,16 +737,19 @@ void MnemonicProcessor(string instruction_name, string &operand, int location_co
         if (type > 0) {
             if (!isOp) {
                 // If operand is missing, log an error
-                addErrors(location_counter, "Missing operand");
+                errors.push_back({location_counter, "Missing operand"});
             } else if (rem > 0) {
                 // If there is extra content after the operand (indicated by rem), log an error
-                addErrors(location_counter, "Extra on end of line");
+                errors.push_back({location_counter, "Extra on end of line"});
             } else {
                 // Process the operand (check if it's valid)
-                string replaceOP = OperandProcessor(operand, location_counter);
+                string_view replaceOP = OperandProcessor(operand, operandIsLabel, text);
                 if (replaceOP.empty()) {
                     // If the operand is invalid, log an error
-                    addErrors(location_counter, "Invalid format: not a valid label or a number");
+                    errors.push_back({location_counter, "Invalid format: not a valid label or a number"});
+                } else if (operandIsLabel ? info->opcode == -1 : !fitsInt(replaceOP)) {
+                    // data and SET take a number, not a label, and a number must fit the word it becomes
+                    errors.push_back({location_counter, "Invalid operand"});
                 } else {
                     // If the operand is valid, update the operand and set the flag
                     operand = replaceOP;
@@ -368,7 +758,7 @@ void MnemonicProcessor(string instruction_name, string &operand, int location_co
             }
         } else if (type == 0 && isOp) {
             // If the mnemonic type is 0 (indicating it shouldn't have an operand) but an operand is provided, log an error
-            addErrors(location_counter, "Unexpected operand");
+            errors.push_back({location_counter, "Unexpected operand"});
         } else {
             // If everything is correct, set the flag to indicate no issues
             flag = true;
@@ -377,269 +767,1933 @@ void MnemonicProcessor(string instruction_name, string &operand, int location_co
 }
 
 
-//Perform the first pass of the assembler to process lines and check for label and operand errors
-void first_pass(const vector<string>& readLines) {
-    int location_counter = 0, program_counter = 0;
-    // Process each line in the input (readLines)
-    for (string curLine : readLines) {
-        ++location_counter;  // Increment location counter (tracks line number)
-        // Parse the current line into components (label, mnemonic, operand)
-        auto cur = parseLine(curLine, location_counter);  
-        if (cur.empty()) continue;  // Skip empty lines after parsing
-        string label = "", instruction_name = "", operand = "";
-        int pos = 0, sz = cur.size();
-        // Process the label (if present) and remove the trailing colon (':')
-        if (cur[pos].back() == ':') {
-            label = cur[pos];           // Store the label
-            label.pop_back();           // Remove the colon (':') at the end of the label
-            ++pos;                      // Move to next token
-        }
-        // Process the mnemonic (instruction name) if it exists
-        if (pos < sz) {
-            instruction_name = cur[pos];  // Store the mnemonic
-            ++pos;                 // Move to next token
-        }
-        // Process the operand (if it exists)
-        if (pos < sz) {
-            operand = cur[pos];   // Store the operand
-            ++pos;                // Move to next token
-        }
-        // Process the label (check for errors related to labels)
-        LabelProcessor(label, location_counter, program_counter);
-        bool flag = false;  // Flag to track if the operand is valid or not
-        string prevOperand = operand;  // Store the original operand for later use (in case it's modified)
-        // Process the mnemonic and operand, checking for errors like missing operands or extra content
-        MnemonicProcessor(instruction_name, operand, location_counter, program_counter, sz - pos, flag);
-        // Record the current line details (for use in second pass, such as generating machine code)
-        lineRecords.push_back({program_counter, label, instruction_name, operand, prevOperand});
-        // If the mnemonic is valid, increment the program counter (advance to next instruction)
-        program_counter += flag;
-        // Handle "SET" instructions (used for variable assignments or label definitions)
-        if (flag && instruction_name == "SET") {
-            // If the label is missing in the SET instruction, add an error
-            if (label.empty()) {
-                addErrors(location_counter,"label(or variable) name missing");
+// Fixed set of worker threads that run numbered tasks; run() returns once every task has finished
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount) {
+        // The calling thread also works on tasks, so it counts as one of the threads
+        for (int i = 1; i < threadCount; ++i) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) worker.join();
+    }
+    int size() const { return workers.size() + 1; }
+    // Call task(0) ... task(taskCount - 1) across the pool and wait for all of them
+    void run(int taskCount, const function<void(int)> &task) {
+        if (workers.empty() || taskCount <= 1) {
+            for (int i = 0; i < taskCount; ++i) task(i);
+            return;
+        }
+        {
+            lock_guard<mutex> lock(guard);
+            current = &task;
+            nextTask = 0;
+            taskTotal = pending = taskCount;
+        }
+        wake.notify_all();
+        work();
+        unique_lock<mutex> lock(guard);
+        finished.wait(lock, [this] { return pending == 0; });
+        nextTask = taskTotal = 0;
+    }
+
+private:
+    vector<thread> workers;
+    mutex guard;                    // Protects everything below
+    condition_variable wake;        // Signalled when tasks are available or the pool is stopping
+    condition_variable finished;    // Signalled when the last task of a run completes
+    const function<void(int)>* current = nullptr;
+    int nextTask = 0, taskTotal = 0, pending = 0;
+    bool stopping = false;
+
+    // Take tasks until none are left
+    void work() {
+        unique_lock<mutex> lock(guard);
+        while (nextTask < taskTotal) {
+            int task = nextTask++;
+            lock.unlock();
+            (*current)(task);
+            lock.lock();
+            if (--pending == 0) finished.notify_all();
+        }
+    }
+    void workerLoop() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || nextTask < taskTotal; });
+            if (stopping) return;
+            lock.unlock();
+            work();
+            lock.lock();
+        }
+    }
+};
+
+// Symbol table work for one line, replayed in source order when the chunks are merged
+struct LineEvent {
+    int record;          // Index of the line in its chunk's records
+    int lineNum;         // Line number in the source file
+    size_t labelHash;    // Hash of the label, computed while the chunk is analysed
+    size_t operandHash;  // Hash of the operand label
+    bool definesLabel;   // The line defines a (valid) label
+    bool usesLabel;      // The operand is a label
+    bool assignsValue;   // The line is a SET with a label
+};
+
+// Result of checking a contiguous range of source lines on its own
+struct ChunkResult {
+    LineRecords lines;                          // Records of the chunk (program counters relative to the chunk)
+    TextArena text;                             // Text made up for the records (converted numbers)
+    vector<ErrorDetails> errors;                // Errors that do not depend on other lines, in line order
+    vector<LineEvent> events;                   // Lines that touch the symbol table
+    vector<pair<int, string_view>> comments;    // Comments of the chunk
+    int instructionCount = 0;                   // Number of words the chunk generates
+};
+
+// Tokenize and check one line, appending what it produces to the chunk; nothing global is touched
+void analyseLine(string_view sourceLine, int location_counter, int &program_counter, ChunkResult &chunk) {
+    LineTokens cur;
+    // Split the current line into components (label, mnemonic, operand)
+    tokenizeLine(sourceLine, cur);
+    // If a comment is found, store it with its line number
+    if (!cur.comment.empty()) {
+        chunk.comments.push_back({location_counter, cur.comment});
+    }
+    if (cur.count == 0) return;  // Skip empty lines after parsing
+    string_view label, instruction_name, operand;
+    int pos = 0, sz = cur.count;
+    // Process the label (if present) and remove the trailing colon (':')
+    if (!cur.token[pos].empty() && cur.token[pos].back() == ':') {
+        label = cur.token[pos].substr(0, cur.token[pos].size() - 1);  // Store the label without its colon
+        ++pos;                      // Move to next token
+    }
+    // Process the mnemonic (instruction name) if it exists
+    if (pos < sz) {
+        instruction_name = cur.token[pos];  // Store the mnemonic
+        ++pos;                 // Move to next token
+    }
+    // Process the operand (if it exists)
+    if (pos < sz) {
+        operand = cur.token[pos];   // Store the operand
+        ++pos;                // Move to next token
+    }
+    // Validate the label using the Validator class; its definition is recorded during the merge
+    bool validLabel = !label.empty() && validator.isValidLabel(label);
+    if (!label.empty() && !validLabel) {
+        chunk.errors.push_back({location_counter, "Bogus Label name"});
+    }
+    bool flag = false;  // Flag to track if the operand is valid or not
+    bool operandIsLabel = false;  // Whether the operand refers to a label
+    string_view prevOperand = operand;  // Store the original operand for later use (in case it's modified)
+    // Process the mnemonic and operand, checking for errors like missing operands or extra content
+    MnemonicProcessor(instruction_name, operand, location_counter, sz - pos, flag, operandIsLabel, chunk.errors, chunk.text);
+    // Handle "SET" instructions (used for variable assignments or label definitions)
+    bool assignsValue = false;
+    if (flag && instruction_name == "SET") {
+        // If the label is missing in the SET instruction, add an error
+        if (label.empty()) {
+            chunk.errors.push_back({location_counter, "label(or variable) name missing"});
+        } else {
+            assignsValue = validLabel;
+        }
+    }
+    if (validLabel || operandIsLabel || assignsValue) {
+        size_t labelHash = validLabel ? SymbolTable::hashLabel(label) : 0;
+        size_t operandHash = operandIsLabel ? SymbolTable::hashLabel(operand) : 0;
+        chunk.events.push_back({(int)chunk.lines.size(), location_counter, labelHash, operandHash, validLabel, operandIsLabel, assignsValue});
+    }
+    // Record the current line details (for use in second pass, such as generating machine code)
+    chunk.lines.push_back(program_counter, label, mnemonicId(instruction_name), operand, prevOperand, location_counter);
+    // If the mnemonic is valid, increment the program counter (advance to next instruction)
+    program_counter += flag;
+}
+
+// Tokenize and check the lines [begin, end); nothing global is touched so chunks can run in parallel
+void analyseChunk(const vector<string_view>& readLines, int begin, int end, ChunkResult &chunk) {
+    chunk.lines.reserve(end - begin);
+    int program_counter = 0;
+    for (int lineIndex = begin; lineIndex < end; ++lineIndex) {
+        analyseLine(readLines[lineIndex], lineIndex + 1, program_counter, chunk);  // Line numbers start at 1
+    }
+    chunk.instructionCount = program_counter;
+}
+
+// Smallest number of lines worth giving to a separate task
+const int MIN_CHUNK_LINES = 8192;
+
+// The listing is formatted into a buffer that is written out whenever it grows past this size
+const size_t LISTING_BUFFER_BYTES = 1 << 20;
+
+// Options shared by every assembly job
+bool writeListing = true;                                   // Whether the .lst file is produced
+bool showTimings = false;                                   // Whether to print how long each pass took
+bool incrementalMode = false;                               // Whether to use and update the cache file
+bool relocatableMode = false;                               // "-c": undefined labels become symbols for --link
+bool optimizeMode = false;                                  // "-O": run the optimizer between the passes
+bool onePassMode = false;                                   // "--one-pass": encode lines as they are read
+int threadCount = max(1u, thread::hardware_concurrency());  // Threads used by the assembler passes (or by the batch)
+
+// Incremental builds ("--incremental") keep a cache file next to the object file with every line's hash
+// and analysis, the symbol table and the words of the last error-free build; a re-run only analyses the
+// lines between the unchanged head and tail of the file and shifts everything after them
+
+// One source line in the cache file; its strings are stored in the text block at the end of the file
+struct CachedLine {
+    uint64_t hash;            // Hash of the line text
+    int32_t programCounter;   // Program counter at the start of the line
+    uint32_t word;            // Word generated for the line (if it has CACHED_HAS_CODE)
+    int32_t symbolIndex;      // Operand label as an index into the cached symbols (-1 if none)
+    int32_t commentOffset;    // Offset of the comment within the line (-1 if none)
+    uint32_t textOffset;      // Label, mnemonic, operand and original operand, one after another
+    uint32_t labelLength, instructionLength, operandLength, previousOperandLength;
+    uint32_t flags;           // CACHED_* bits
+};
+
+const uint32_t CACHED_HAS_RECORD = 1;     // The line has a statement (an entry in lineRecords)
+const uint32_t CACHED_HAS_CODE = 2;       // The statement generated a word
+const uint32_t CACHED_DEFINES_LABEL = 4;  // The line defines a label (with or without SET)
+
+// Pack an operand and an opcode into one word: operand in the upper 24 bits, opcode in the last 8
+uint32_t encodeWord(int operand, int opcode) {
+    return (static_cast<uint32_t>(operand) << 8) | static_cast<uint32_t>(opcode);
+}
+
+// Source file mapped read-only into memory; every line and token is a view into it
+class SourceFile {
+public:
+    // Map the file; returns false if it cannot be opened
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size = info.st_size;
+        if (size > 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                // Not mappable (e.g. a pipe): fall back to reading it into a buffer
+                buffer.resize(size);
+                size_t done = 0;
+                while (done < size) {
+                    ssize_t got = ::read(fd, &buffer[done], size - done);
+                    if (got <= 0) break;
+                    done += got;
+                }
+                buffer.resize(done);
+                size = done;
+                data = buffer.data();
+            } else {
+                data = static_cast<const char*>(mapped);
+                isMapped = true;
+                madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return true;
+    }
+    string_view text() const { return {data, size}; }
+    ~SourceFile() {
+        if (isMapped) munmap(const_cast<char*>(data), size);
+    }
+
+private:
+    const char* data = "";
+    size_t size = 0;
+    bool isMapped = false;
+    string buffer;  // Only used when the file could not be mapped
+};
+
+// Source file read a block at a time, for "--one-pass": only the lines of the current block are in memory
+class LineReader {
+public:
+    // Open the file; returns false if it cannot be opened
+    bool open(const char* path) {
+        fd = ::open(path, O_RDONLY);
+        return fd >= 0;
+    }
+    // Replace lines with the next block of lines (views into the reader, valid until the next call), split the
+    // way the whole file would be; returns false once the file is exhausted
+    bool nextBlock(vector<string_view> &lines) {
+        lines.clear();
+        // The unfinished last line of the previous block starts the new one
+        memmove(buffer.get(), buffer.get() + start, filled - start);
+        filled -= start;
+        start = 0;
+        // A line longer than the buffer gets a bigger one
+        if (filled == capacity) {
+            unique_ptr<char[]> larger(new char[2 * capacity + BLOCK_PADDING]);
+            memcpy(larger.get(), buffer.get(), filled);
+            buffer = move(larger);
+            capacity *= 2;
+        }
+        while (!atEnd && filled < capacity) {
+            ssize_t got = ::read(fd, buffer.get() + filled, capacity - filled);
+            if (got <= 0) atEnd = true;
+            else filled += got;
+        }
+        const char* text = buffer.get();
+        while (const char* newline = static_cast<const char*>(memchr(text + start, '\n', filled - start))) {
+            lines.push_back(string_view(text + start, newline - (text + start)));
+            start = newline + 1 - text;
+        }
+        // A last line without a newline still counts as a line
+        if (atEnd && start < filled) {
+            lines.push_back(string_view(text + start, filled - start));
+            start = filled;
+        }
+        return !lines.empty() || !(atEnd && start == filled);
+    }
+    ~LineReader() {
+        if (fd >= 0) ::close(fd);
+    }
+
+private:
+    static constexpr size_t BLOCK_BYTES = 1 << 20;
+    static constexpr size_t BLOCK_PADDING = 64;  // The vector scanners may look a little past the last line
+    int fd = -1;
+    unique_ptr<char[]> buffer{new char[BLOCK_BYTES + BLOCK_PADDING]};
+    size_t capacity = BLOCK_BYTES;  // Usable bytes of buffer
+    size_t filled = 0;              // Bytes of buffer read from the file
+    size_t start = 0;               // Start of the first line not handed out yet
+    bool atEnd = false;             // The whole file has been read
+};
+
+// Layout of the cache file: the header, then lineCount CachedLines, symbolCount CachedSymbols,
+// referenceCount line numbers and textSize bytes of text
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t lineCount, symbolCount, referenceCount;
+    uint64_t textSize;
+    int32_t programSize;
+    uint32_t reserved;
+};
+
+// One symbol in the cache file
+struct CachedSymbol {
+    uint32_t labelOffset, labelLength;        // Label in the text block
+    uint32_t valueOffset, valueLength;        // SET value in the text block
+    int32_t address, lineNum;
+    uint32_t firstReference, referenceCount;  // Its line numbers in the reference block
+    uint32_t isVariable;
+};
+
+const uint32_t CACHE_MAGIC = 0x32435341;  // "ASC2"
+
+// Object files: the header, then sectionCount ObjectSections, symbolCount ObjectSymbols, relocationCount
+// ObjectRelocations, stringBytes of symbol names (padded to a multiple of 4) and the words of the sections.
+// Addresses are in words from the start of the object. "asm --link" places objects one after another and
+// applies their relocations; the emulator loads any object that has no undefined symbols
+struct ObjectHeader {
+    uint32_t magic;
+    uint32_t imageWords;      // Words the object takes up once loaded
+    uint32_t sectionCount, symbolCount, relocationCount;
+    uint32_t stringBytes;
+};
+
+// A run of words generated by instructions (code) or by data and SET lines (data)
+struct ObjectSection {
+    uint32_t kind;            // SECTION_CODE or SECTION_DATA
+    uint32_t address;         // Address of the first word
+    uint32_t wordCount;
+    uint32_t offset;          // File offset of the words
+};
+
+struct ObjectSymbol {
+    uint32_t nameOffset, nameLength;  // Name in the string block
+    int32_t value;            // Address of the label, or the SET value
+    uint32_t flags;           // SYMBOL_* bits
+};
+
+// An operand field the linker adjusts once it knows where the object and the symbol end up
+struct ObjectRelocation {
+    uint32_t address;         // Word to patch
+    uint32_t kind;            // RELOC_ABSOLUTE or RELOC_RELATIVE
+    int32_t symbol;           // Index into the object's symbols, or -1 for the start of the object itself
+};
+
+const uint32_t OBJECT_MAGIC = 0x314A424F;  // "OBJ1"
+const uint32_t SECTION_CODE = 1, SECTION_DATA = 2;
+const uint32_t SYMBOL_DEFINED = 1;   // Defined in this object; the others are left to the linker
+const uint32_t SYMBOL_ABSOLUTE = 2;  // SET value, which does not move with the object
+const uint32_t RELOC_ABSOLUTE = 0;   // operand += value (value operands)
+const uint32_t RELOC_RELATIVE = 1;   // operand += value - (address + 1), the way offset operands are encoded
+
+// Add delta to the 24 bit operand field of a word
+uint32_t relocateWord(uint32_t word, int delta) {
+    return encodeWord((static_cast<int32_t>(word) >> 8) + delta, word & 0xFF);
+}
+
+// "-O": peephole and branch optimizations on the parsed lines, run between the two passes. Removed words are
+// dropped from the program, so afterwards every line gets its program counter again, labels follow their
+// lines and branch operands are re-encoded. Lines keep their place in lineRecords; the listing shows for
+// each changed line what it was. The emulator is the reference: call takes an absolute address there, and
+// return continues one word after the address in A (after a call, or after a label loaded with ldc).
+// Addresses are assumed to come from labels only: code that is read or written as data, or jumped to
+// through computed addresses, is not followed
+class Optimizer {
+public:
+    Optimizer(LineRecords &lines, TextArena &text, SymbolTable &symbols, int &programSize, vector<string> &notes)
+        : lines(lines), text(text), symbols(symbols), programSize(programSize), notes(notes) {}
+
+    // Optimize the program; returns a summary of what changed, or why it was left alone
+    string run() {
+        if (!analyse()) return "not optimized: " + skipped;
+        for (int round = 0; round < 8; ++round) {
+            int before = removedCount + changeCount;
+            if (!removeUnreachable()) return "not optimized: " + skipped;
+            threadJumps();
+            peephole();
+            if (removedCount + changeCount == before) break;
+        }
+        relocate();
+        int rewrittenCount = 0;
+        for (int r = 0; r < n; ++r) rewrittenCount += !removed[r] && !notes[r].empty();
+        return "removed " + to_string(removedCount) + " word(s), rewrote " + to_string(rewrittenCount);
+    }
+
+private:
+    enum : int {
+        OP_LDC = 0x00, OP_ADC = 0x01, OP_LDL = 0x02, OP_STL = 0x03, OP_ADD = 0x06, OP_SUB = 0x07, OP_SHL = 0x08,
+        OP_SHR = 0x09, OP_ADJ = 0x0A, OP_SP2A = 0x0C, OP_CALL = 0x0D, OP_RETURN = 0x0E, OP_BRZ = 0x0F,
+        OP_BRLZ = 0x10, OP_BR = 0x11, OP_HALT = 0x12
+    };
+    static const int EXTERNAL = -2;   // Target of a branch to a label of another object (-c)
+
+    LineRecords &lines;
+    TextArena &text;                 // Where rewritten operands are kept
+    SymbolTable &symbols;
+    int &programSize;
+    vector<string> &notes;           // Per line: what the optimizer did to it (empty if nothing)
+    int n = 0;                       // Number of lines; also stands for "the end of the program" as a target
+    vector<const OpcodeInfo*> info;  // Mnemonic of every line that generates a word (nullptr for the others)
+    vector<int> target;              // For br, brz, brlz and call: the line of the word they transfer control to
+    vector<int> next, prev;          // Words still in the program, as a list; a removed word keeps its next link
+    int head = 0;                    // First word still in the program (n if none)
+    vector<char> removed;            // Word dropped from the program
+    vector<char> entry;              // Word that may be reached other than by falling into it
+    vector<char> pinned;             // Word whose address or contents matter: never changed or removed
+    vector<char> root;               // Where execution may start: address 0, address-taken words, exported labels
+    vector<int> oldPc;               // Program counter of every line before optimizing
+    vector<int> oldAddress;          // Address of every symbol before optimizing
+    vector<int> labelOfWord;         // A label that resolves to the word of a line (-1 if none)
+    vector<string> merged;           // Original statements a folded line stands for (empty if just its own)
+    int removedCount = 0, changeCount = 0;
+    string skipped;                  // Why the program cannot be optimized
+
+    // Sign-extended 24 bit operand, as the emulator decodes it
+    static int operandValue(long long value) {
+        return static_cast<int32_t>(static_cast<uint32_t>(value) << 8) >> 8;
+    }
+    static bool fits(long long value) {
+        return value >= -(1 << 23) && value < (1 << 23);
+    }
+    bool isCode(int w) const {
+        return w < n && !removed[w] && info[w] && info[w]->opcode != -1;
+    }
+    int opcode(int w) const { return info[w]->opcode; }
+    bool isControl(int w) const {
+        int op = opcode(w);
+        return op == OP_BR || op == OP_BRZ || op == OP_BRLZ || op == OP_CALL;
+    }
+    // A word that may be rewritten or removed; inner words are also only ever reached by falling into them
+    bool isMutable(int w) const { return isCode(w) && !pinned[w]; }
+    bool isInner(int w) const { return isMutable(w) && !entry[w]; }
+    // Whether the word overwrites B without reading it first, so B is dead just before it
+    bool killsB(int w) const {
+        if (!isCode(w)) return false;
+        int op = opcode(w);
+        return op == OP_LDC || op == OP_LDL || op == OP_SP2A || op == OP_CALL;
+    }
+    // The operand as a number: a literal or a SET value (labels move, so they are not constants)
+    bool constant(int w, int &value) const {
+        int symbol = lines.symbolIndex[w];
+        if (symbol == -1) {
+            value = operandValue(toLong(lines.operand[w]));
+        } else if (symbols[symbol].isVariable) {
+            value = operandValue(toLong(symbols[symbol].value));
+        } else {
+            return false;
+        }
+        return true;
+    }
+    // The statement as written, or the statements folded into it
+    string original(int w) const {
+        if (!merged[w].empty()) return merged[w];
+        string statement(lines.instruction(w));
+        if (!lines.previousOperand[w].empty()) statement.append(" ").append(lines.previousOperand[w]);
+        return statement;
+    }
+    // The word a target stands for now: removed words hand it on to the word after them
+    int resolve(int w) const {
+        while (w >= 0 && w < n && removed[w]) w = next[w];
+        return w;
+    }
+
+    // Build the word list, the branch targets and what may not be touched; false if the program has a
+    // branch that leaves it
+    bool analyse() {
+        n = lines.size();
+        info.assign(n, nullptr);
+        target.assign(n, n);
+        next.assign(n + 1, n);
+        prev.assign(n + 1, -1);
+        removed.assign(n, 0);
+        entry.assign(n + 1, 0);
+        pinned.assign(n + 1, 0);
+        root.assign(n + 1, 0);
+        oldPc.resize(n);
+        labelOfWord.assign(n + 1, -1);
+        merged.resize(n);
+        notes.assign(n, "");
+        vector<int> wordAt(programSize, n);
+        int last = -1;
+        head = n;
+        for (int r = 0; r < n; ++r) {
+            oldPc[r] = lines.programCounter[r];
+            if (lines.mnemonic[r] == -1) continue;
+            info[r] = lines.info(r);
+            wordAt[oldPc[r]] = r;
+            if (last == -1) head = r;
+            else next[last] = r;
+            prev[r] = last;
+            last = r;
+            if (info[r]->opcode == -1) pinned[r] = 1;  // data and SET words
+        }
+        if (head < n) entry[head] = root[head] = 1;
+        auto wordOf = [&](int address) { return address < programSize ? wordAt[address] : n; };
+        oldAddress.resize(symbols.entries.size());
+        for (size_t s = 0; s < symbols.entries.size(); ++s) oldAddress[s] = symbols.entries[s].address;
+        for (int r = 0; r < n; ++r) {
+            if (lines.label[r].empty()) continue;
+            int symbol = symbols.find(lines.label[r]);
+            if (symbol == -1) continue;
+            int w = wordOf(oldPc[r]);
+            entry[w] = 1;
+            if (labelOfWord[w] == -1 && !symbols[symbol].isVariable) labelOfWord[w] = symbol;
+            if (relocatableMode) pinned[w] = root[w] = 1;  // Other objects may branch to any label
+        }
+        for (int r = 0; r < n; ++r) {
+            if (!info[r] || info[r]->opcode == -1) continue;
+            int symbol = lines.symbolIndex[r];
+            if (info[r]->type == 1 && symbol != -1 && !symbols[symbol].isVariable && symbols[symbol].address != -1) {
+                // An address loaded as a value: the word may be read, and return continues after it
+                int w = wordOf(symbols[symbol].address);
+                for (int k = 0; k < 2 && w < n; ++k, w = next[w]) pinned[w] = entry[w] = root[w] = 1;
+            }
+            if (!isControl(r)) continue;
+            if (symbol != -1 && symbols[symbol].address == -1) {
+                target[r] = EXTERNAL;
+                continue;
+            }
+            long long encoded = symbol != -1 ? symbols[symbol].address - (oldPc[r] + 1) : toLong(lines.operand[r]);
+            long long address = info[r]->opcode == OP_CALL ? operandValue(encoded) : oldPc[r] + 1 + operandValue(encoded);
+            if (address < 0 || address > programSize) {
+                skipped = "line " + to_string(lines.lineNum[r]) + " branches outside the program";
+                return false;
+            }
+            target[r] = wordOf(address);
+            entry[target[r]] = 1;
+        }
+        return true;
+    }
+
+    void remove(int w, const string &reason) {
+        removed[w] = 1;
+        if (prev[w] == -1) head = next[w];
+        else next[prev[w]] = next[w];
+        if (next[w] < n) prev[next[w]] = prev[w];
+        // A label or branch that led here now leads to the next word
+        if (entry[w]) entry[next[w]] = 1;
+        notes[w] = "removed: " + original(w) + " (" + reason + ")";
+        ++removedCount;
+    }
+    // Replace the statement of w, which stands for the statements in merged[w]
+    void rewrite(int w, string_view instruction, const string &operand) {
+        lines.mnemonic[w] = mnemonicId(instruction);
+        lines.operand[w] = lines.previousOperand[w] = text.store(operand);
+        lines.symbolIndex[w] = -1;
+        info[w] = lines.info(w);
+        notes[w] = "was: " + merged[w];
+        ++changeCount;
+    }
+
+    // Drop code that no path from a root reaches; data words run as code are followed too
+    bool removeUnreachable() {
+        vector<char> reached(n + 1, 0);
+        vector<int> stack;
+        for (int w = head; w < n; w = next[w]) {
+            if (root[w]) stack.push_back(w);
+        }
+        while (!stack.empty()) {
+            int w = resolve(stack.back());
+            stack.pop_back();
+            if (w >= n || reached[w]) continue;
+            reached[w] = 1;
+            int op = info[w]->opcode;
+            if (op == -1) {
+                // A data word that is executed: anything but a plain instruction makes the flow unknown
+                op = strtol(string(lines.operand[w]).c_str(), nullptr, 10) & 0xFF;
+                if (op == OP_BR || op == OP_BRZ || op == OP_BRLZ || op == OP_CALL) {
+                    skipped = "the data word of line " + to_string(lines.lineNum[w]) + " is run as a branch";
+                    return false;
+                }
+                if (op > OP_HALT) continue;  // Invalid opcode: execution stops there
+            } else if (isControl(w) && target[w] != EXTERNAL) {
+                stack.push_back(target[w]);
+            }
+            if (op != OP_BR && op != OP_RETURN && op != OP_HALT) stack.push_back(next[w]);
+        }
+        for (int w = head; w < n; w = next[w]) {
+            if (!reached[w] && isMutable(w)) remove(w, "unreachable");
+        }
+        return true;
+    }
+
+    // Branches to a br go straight to where it leads; a conditional branch also passes through branches on
+    // the same condition, since A has not changed
+    void threadJumps() {
+        for (int w = head; w < n; w = next[w]) {
+            if (!isMutable(w) || !isControl(w) || target[w] == EXTERNAL) continue;
+            int to = resolve(target[w]);
+            for (int steps = 0; steps < 32 && isCode(to) && to != w && target[to] != EXTERNAL; ++steps) {
+                int op = opcode(to);
+                if (op != OP_BR && (op != opcode(w) || op == OP_CALL)) break;
+                to = resolve(target[to]);
+            }
+            if (to != resolve(target[w])) {
+                target[w] = to;
+                entry[to] = 1;
+                notes[w] = "was: " + original(w);
+                ++changeCount;
+            }
+        }
+    }
+
+    // Fold constants, drop instructions without effect and stores of the value just loaded
+    void peephole() {
+        for (int w = head; w < n; ) {
+            if (!isMutable(w)) {
+                w = next[w];
+                continue;
+            }
+            int op = opcode(w), value = 0, other = 0;
+            if ((op == OP_ADC || op == OP_ADJ) && constant(w, value) && value == 0) {
+                int after = next[w];
+                remove(w, "no effect");
+                w = after;
+                continue;
+            }
+            if ((op == OP_BR || op == OP_BRZ || op == OP_BRLZ) && target[w] != EXTERNAL && resolve(target[w]) == next[w]) {
+                int after = next[w];
+                remove(w, "branch to the next word");
+                w = after;
+                continue;
+            }
+            int s = next[w];
+            if (!isInner(s)) {
+                w = next[w];
+                continue;
+            }
+            int op2 = opcode(s);
+            // ldc a; adc b -> ldc a+b, and runs of adc or adj
+            if (((op == OP_LDC && op2 == OP_ADC) || (op == OP_ADC && op2 == OP_ADC) || (op == OP_ADJ && op2 == OP_ADJ))
+                && constant(w, value) && constant(s, other) && fits((long long)value + other)) {
+                merged[w] = original(w) + "; " + original(s);
+                rewrite(w, lines.instruction(w), to_string(value + other));
+                remove(s, "folded into line " + to_string(lines.lineNum[w]));
+                continue;
+            }
+            // ldl k; stl k writes back what is there and leaves A alone; it only copies A to B, which is dead if
+            // the next word overwrites B
+            if (op == OP_LDL && op2 == OP_STL && lines.symbolIndex[w] == -1 && lines.symbolIndex[s] == -1
+                && toLong(lines.operand[w]) == toLong(lines.operand[s]) && killsB(next[s])) {
+                int after = next[s];
+                remove(w, "value stored back unchanged");
+                remove(s, "value stored back unchanged");
+                w = after;
+                continue;
+            }
+            // ldc a; ldc b; add/sub/shl/shr -> ldc (a op b) when B is dead afterwards
+            int t = next[s];
+            if (op == OP_LDC && op2 == OP_LDC && isInner(t) && killsB(next[t]) && constant(w, value) && constant(s, other)) {
+                int op3 = opcode(t);
+                long long result = 0;
+                bool folds = true;
+                if (op3 == OP_ADD) result = (long long)value + other;
+                else if (op3 == OP_SUB) result = (long long)value - other;
+                else if ((op3 == OP_SHL || op3 == OP_SHR) && other >= 0 && other < 32) {
+                    result = op3 == OP_SHL ? static_cast<int32_t>(static_cast<uint32_t>(value) << other) : value >> other;
+                } else {
+                    folds = false;
+                }
+                if (folds && fits(result)) {
+                    merged[w] = original(w) + "; " + original(s) + "; " + original(t);
+                    rewrite(w, "ldc", to_string(result));
+                    remove(s, "folded into line " + to_string(lines.lineNum[w]));
+                    remove(t, "folded into line " + to_string(lines.lineNum[w]));
+                    continue;
+                }
+            }
+            w = next[w];
+        }
+    }
+
+    // Give every line its new program counter, move the labels and re-encode the operands that depend on
+    // distances between words
+    void relocate() {
+        int pc = 0;
+        for (int r = 0; r < n; ++r) {
+            lines.programCounter[r] = pc;
+            if (info[r] && !removed[r]) ++pc;
+        }
+        programSize = pc;
+        for (int r = 0; r < n; ++r) {
+            if (lines.label[r].empty()) continue;
+            int symbol = symbols.find(lines.label[r]);
+            if (symbol != -1) symbols[symbol].address = lines.programCounter[r];
+        }
+        auto addressOf = [&](int w) { return w >= n ? programSize : lines.programCounter[w]; };
+        for (int r = 0; r < n; ++r) {
+            if (!info[r]) continue;
+            if (removed[r]) {
+                lines.mnemonic[r] = -1;
+                lines.operand[r] = lines.previousOperand[r] = {};
+                lines.symbolIndex[r] = -1;
+                continue;
+            }
+            if (info[r]->type != 2) continue;
+            int symbol = lines.symbolIndex[r], address = lines.programCounter[r];
+            if (symbol != -1 && symbols[symbol].address == -1) continue;  // Left to the linker
+            long long current = symbol != -1 ? symbols[symbol].address - (address + 1) : toLong(lines.operand[r]);
+            long long wanted;
+            if (!isControl(r)) {
+                // ldl, stl, ldnl and stnl offsets are not distances between words: keep the value they had
+                if (symbol == -1) continue;
+                wanted = oldAddress[symbol] - (oldPc[r] + 1);
+            } else if (target[r] == EXTERNAL) {
+                continue;
+            } else if (opcode(r) == OP_CALL) {
+                wanted = addressOf(target[r]);
+            } else {
+                wanted = addressOf(target[r]) - (address + 1);
+            }
+            if (operandValue(current) == operandValue(wanted)) continue;
+            if (notes[r].empty()) notes[r] = "was: " + original(r);
+            int label = isControl(r) && opcode(r) != OP_CALL ? labelOfWord[resolve(target[r])] : -1;
+            if (label != -1 && symbols[label].address == addressOf(target[r])) {
+                lines.operand[r] = lines.previousOperand[r] = text.store(symbols[label].label);
+                lines.symbolIndex[r] = label;
             } else {
-                // Store SET instruction information (label and operand) for later processing
-                variableAssignments.push_back({label, operand});
+                lines.operand[r] = lines.previousOperand[r] = text.store(to_string(wanted));
+                lines.symbolIndex[r] = -1;
             }
         }
     }
-    // After processing all lines, check for errors related to undefined labels
-    for (auto label : symbolTable) {
-        bool labelUsed = false;
-        
-        // Check if the label is used in any instruction (check label references)
-        for (const auto& labelRef : labelReferences) {
-            if (labelRef.first == label.first) {
-                labelUsed = true;
-                break;  // Label is used, no need to check further
+};
+
+// One assembly job: a source file, the files it produces and all the state of the two passes.
+// Jobs share nothing but the read-only tables above, so several of them can run at once
+class Assembler {
+public:
+    // The job reads sourcePath and writes the log, listing, object and (incremental) cache files given
+    Assembler(string sourcePath, string logPath, string listingPath, string objectPath, string cachePath, ThreadPool &pool, bool verbose)
+        : sourcePath(move(sourcePath)), logPath(move(logPath)), listingPath(move(listingPath)), objectPath(move(objectPath)),
+          cachePath(move(cachePath)), pool(pool), verbose(verbose) {}
+
+    // Run both passes (or the single one of "--one-pass") and write the output files; returns false if the
+    // source is missing or has errors
+    bool assemble() {
+        if (onePassMode) return one_pass();
+        if (!readFile()) {
+            inputMissing = true;
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+        if (incrementalMode) hashLines();
+        if (!incrementalMode || !incrementalFirstPass()) first_pass(readLines);
+        if (showTimings && verbose) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            printf("first pass: %.3f s, %.1f MB/s, %d thread(s)\n", seconds, sourceFile.text().size() / seconds / 1e6, pool.size());
+        }
+        show_warnings_and_errors();
+        if (errorList.empty()) {
+            if (optimizeMode) {
+                start = chrono::steady_clock::now();
+                optimizerSummary = Optimizer(lineRecords, recordText, symbolTable, programSize, optimizerNotes).run();
+                if (verbose) cout << "Optimizer: " << optimizerSummary << endl;
+                if (showTimings && verbose) {
+                    printf("optimizer: %.3f s\n", chrono::duration<double>(chrono::steady_clock::now() - start).count());
+                }
             }
+            start = chrono::steady_clock::now();
+            second_pass();
+            if (showTimings && verbose) {
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                printf("second pass: %.3f s, %.1f M lines/s, %d thread(s)\n", seconds, lineRecords.size() / seconds / 1e6, pool.size());
+            }
+            writeFile();
+        }
+        if (incrementalMode) {
+            // Only an error-free build is cached; after a failed one the next build starts from scratch
+            if (errorList.empty()) saveCache();
+            else remove(cachePath.c_str());
         }
-        // If the label's address is still -1, it is undefined
-        if (label.second.first == -1) {
-            // Report errors for all lines that refer to this undefined label
-            for (const auto& labelRef : labelReferences) {
-                if (labelRef.first == label.first) {
-                    for (int line : labelRef.second) {
-                        addErrors(line,"no such label");  // Report error for each usage of the undefined label
+        return errorList.empty();
+    }
+
+    bool inputMissing = false;                   // The source file could not be opened
+    vector<WarningDetails> warningList;          // List to store all warnings encountered
+    vector<ErrorDetails> errorList;              // List to store all errors encountered
+    int programSize = 0;                         // Number of words the program generates (program counter after the last line)
+    string optimizerSummary;                     // What "-O" did
+
+private:
+    string sourcePath, logPath, listingPath, objectPath, cachePath;  // Input file and the files this job writes
+    ThreadPool &pool;                            // Threads the passes run on
+    bool verbose;                                // Whether to print progress messages
+
+    // Containers to store different information related to lines, listings and symbols
+    vector<ListingDetails> listingEntries;       // List to store the generated listing file entries
+    LineRecords lineRecords;                     // Program line information, one array per field
+    TextArena recordText;                        // Text of the records that is not in the source or cache file
+    vector<uint32_t> machineCode;                // Generated machine code words, in output order
+    SymbolTable symbolTable;                     // All labels, with their addresses, references and SET values
+    vector<pair<int, string_view>> commentLines; // {line, comment} (views into the source file)
+    vector<string> optimizerNotes;               // Per line, what the optimizer changed (empty without "-O")
+    SourceFile sourceFile;                       // The mapped input file
+    vector<string_view> readLines;               // stores each line (views into sourceFile)
+
+    // State of an incremental build
+    SourceFile cacheFile;                        // The mapped cache file of the previous build
+    vector<uint64_t> lineHashes;                 // Hash of every source line
+    const CachedLine* cachedLines = nullptr;     // Lines of the cached build (inside the mapped cache file)
+    vector<int> cachedLineOfRecord;              // For every record, the cached line it was replayed from (-1 if analysed)
+    vector<int> previousAddress;                 // For every symbol, its address in the cached build
+    vector<bool> redefinedSymbol;                // For every symbol, whether its definition was in the edited region
+
+    // State of a one-pass build: the words and listing are emitted as the lines are read, and a word whose
+    // operand label is not defined yet is chained to the label and patched when the definition comes
+    struct Fixup {
+        int lineNum;             // Line of the word (reported if the label is never defined)
+        int address;             // Address of the word
+        const OpcodeInfo* info;  // Mnemonic of the word
+        long long listingOffset; // Position of the word in the listing file (-1 if it is not listed)
+        int next;                // Next fixup of the same label, or of the free list (-1 if last)
+    };
+    vector<Fixup> fixups;                        // Fixups of all labels; resolved ones are reused
+    vector<int> fixupHead, fixupTail;            // For every symbol, its first and last pending fixup (-1 if none)
+    int freeFixups = -1;                         // First reusable entry of fixups
+    vector<char> wordIsData;                     // For every word, whether it came from data or SET
+    vector<ObjectRelocation> wordRelocations;    // Relocations of the words emitted so far, sorted at the end
+    int listingFile = -1;                        // The listing being written (-1 if there is none)
+    string listingBuffer;                        // Listing text not written to listingFile yet
+    long long listingWritten = 0;                // Bytes of the listing already in listingFile
+    vector<pair<long long, uint32_t>> listingPatches;  // Patches to listing text already written: offset, word
+
+    // Function to add a warning to the warning list
+    void addWarnings(int location, const char* message) {
+        warningList.push_back({location, message});  // Add a new warning with its location and message
+    }
+
+    // Function to add an error to the error list
+    void addErrors(int location, const char* message) {
+        errorList.push_back({location, message});  // Add a new error with its location and message
+    }
+
+    // Process labels and check for errors
+    // Record the definition of an already validated label (whose hash is given) in the symbol table;
+    // returns its index, or -1 for a duplicate definition
+    int LabelProcessor(string_view label, size_t hash, int location_counter, int program_counter) {
+        // Check if the label already exists in the symbol table
+        int index = symbolTable.find(label, hash);
+        if (index == -1) {
+            // If the label wasn't found in the symbol table, add a new entry with the label, program counter, and location counter
+            return symbolTable.insert(label, hash, program_counter, location_counter);
+        } else if (symbolTable[index].address != -1) {
+            // If the label already has a valid program counter, it's a duplicate definition
+            addErrors(location_counter, "Duplicate label definition");
+            return -1;
+        } else {
+            // If the label exists but hasn't been defined yet, update its program counter and location counter
+            symbolTable[index].address = program_counter;
+            symbolTable[index].lineNum = location_counter;
+            return index;
+        }
+    }
+
+    // Record a use of a label (whose hash is given) as an operand and return its index in the symbol table
+    int ReferenceProcessor(string_view label, size_t hash, int location_counter) {
+        // Find the label in the symbol table, adding it with a placeholder (-1 program counter) if it is not defined yet
+        int index = symbolTable.findOrInsert(label, hash, -1, location_counter);
+        // Append the current location counter to its reference list
+        symbolTable.addReference(index, location_counter);
+        return index;
+    }
+
+    // After processing all lines, check for errors related to undefined labels and for unused labels
+    void checkSymbols() {
+        for (size_t index = 0; index < symbolTable.entries.size(); ++index) {
+            const SymbolEntry &label = symbolTable.entries[index];
+            // If the label's address is still -1, it is undefined (with -c it is left to the linker)
+            if (label.address == -1) {
+                if (relocatableMode) continue;
+                // Report errors for all lines that refer to this undefined label
+                auto report = [this](int line) {
+                    addErrors(line,"no such label");  // Report error for each usage of the undefined label
+                };
+                // A one-pass build keeps every use of a label that is never defined in its fixup chain
+                if (onePassMode) forEachFixup(index, report);
+                else symbolTable.forEachReference(index, report);
+            } else if (label.firstReference == -1) {
+                // If the label is declared but never used, add a warning
+                warningList.push_back({label.lineNum, "Label declared but not used"});
+            }
+        }
+    }
+
+    //Perform the first pass of the assembler to process lines and check for label and operand errors
+    // Lines are checked in parallel chunks; the chunks are then merged in order so the result matches a serial pass
+    void first_pass(const vector<string_view>& readLines) {
+        int lineCount = readLines.size();
+        int chunkCount = max(1, min(pool.size() * 4, lineCount / MIN_CHUNK_LINES));
+        vector<ChunkResult> chunks(chunkCount);
+        pool.run(chunkCount, [&](int c) {
+            analyseChunk(readLines, (long long)lineCount * c / chunkCount, (long long)lineCount * (c + 1) / chunkCount, chunks[c]);
+        });
+
+        // Prefix sum of the instruction counts gives every chunk its starting program counter
+        vector<int> chunkBase(chunkCount, 0);
+        for (int c = 1; c < chunkCount; ++c) {
+            chunkBase[c] = chunkBase[c - 1] + chunks[c - 1].instructionCount;
+        }
+        programSize = chunkBase[chunkCount - 1] + chunks[chunkCount - 1].instructionCount;
+        pool.run(chunkCount, [&](int c) {
+            for (int &pc : chunks[c].lines.programCounter) pc += chunkBase[c];
+        });
+
+        // Merge in source order: define and reference labels, and place duplicate label errors
+        // ahead of the other errors of the same line, exactly where a serial pass reports them
+        for (auto &chunk : chunks) {
+            size_t nextError = 0;
+            LineRecords &lines = chunk.lines;
+            for (const auto &event : chunk.events) {
+                int r = event.record;
+                // Errors of earlier lines come first
+                while (nextError < chunk.errors.size() && chunk.errors[nextError].position < event.lineNum) {
+                    errorList.push_back(chunk.errors[nextError++]);
+                }
+                // Process the label (check for errors related to labels)
+                if (event.definesLabel) LabelProcessor(lines.label[r], event.labelHash, event.lineNum, lines.programCounter[r]);
+                if (event.usesLabel) lines.symbolIndex[r] = ReferenceProcessor(lines.operand[r], event.operandHash, event.lineNum);
+                if (event.assignsValue) {
+                    // Store SET instruction information (label and operand) for later processing
+                    int index = symbolTable.find(lines.label[r], event.labelHash);
+                    if (index != -1 && !symbolTable[index].isVariable) {
+                        symbolTable[index].isVariable = true;
+                        symbolTable[index].value = lines.operand[r];
                     }
-                    break;
                 }
             }
-        } else if (!labelUsed) {
-            // If the label is declared but never used, add a warning
-            warningList.push_back({label.second.second, "Label declared but not used"});
+            errorList.insert(errorList.end(), chunk.errors.begin() + nextError, chunk.errors.end());
+            commentLines.insert(commentLines.end(), chunk.comments.begin(), chunk.comments.end());
+            recordText.splice(chunk.text);
         }
+        // The records of all chunks, in order
+        if (chunkCount == 1) {
+            lineRecords = move(chunks[0].lines);
+        } else {
+            vector<LineRecords*> parts;
+            for (auto &chunk : chunks) parts.push_back(&chunk.lines);
+            lineRecords.gather(parts);
+        }
+
+        checkSymbols();
     }
-}
 
-// Inserting the current program counter, machine code, and source line details into the listingEntries vector
-void add_in_list(int program_counter, string machine_code, string label, string mnemonic, string operand) {
-    // If mnemonic is not empty, add a space to it (standard mnemonic format)
-    if (!mnemonic.empty()) mnemonic += " ";
-    // If label is not empty, add a colon to it (standard label format)
-    if (!label.empty()) label += ": ";
-    // Combine label, mnemonic, and operand to form the complete source line statement
-    string statement = label + mnemonic + operand;
-    // Convert the program counter (which is in decimal) to hexadecimal format for machine code listing
-    // Then, add the current program counter in hex, the machine code, and the statement to the listingEntries vector
-    listingEntries.push_back({converter.decToHex(program_counter), machine_code, statement});
-}
+    // Whether the cached word of a replayed line is still correct: an operand label must keep its address,
+    // or for branches its distance from the line
+    bool cachedWordIsValid(int r, const CachedLine &entry) {
+        int index = lineRecords.symbolIndex[r];
+        if (index == -1) return true;  // Numbers and missing operands do not depend on other lines
+        const SymbolEntry &symbol = symbolTable[index];
+        int before = previousAddress[index];
+        if (lineRecords.info(r)->type == 2) {
+            return symbol.address - lineRecords.programCounter[r] == before - entry.programCounter;
+        }
+        // Outside the edited region SET values do not change, so only a plain label's address matters
+        return !redefinedSymbol[index] && (symbol.isVariable || symbol.address == before);
+    }
 
-// Generating machine codes and building the listing vector
-void second_pass() {
-    // Iterate through each line record
-    for (auto curLine : lineRecords) {
-        // Extract label, mnemonic, operand, and previous operand for the current line
-        string label = curLine.label, mnemonic = curLine.instruction, operand = curLine.operand;
-        string prevOperand = curLine.previousOperand;
-        int program_counter = curLine.programCounter, type = -1;
-        string opcode = "";
-        // Find mnemonic in opcodeTable to retrieve its type and corresponding opcode
-        for (const auto& opcodeEntry : opcodeTable) {
-            if (opcodeEntry.first == mnemonic) {
-                opcode = opcodeEntry.second.first;  // Retrieve opcode
-                type = opcodeEntry.second.second;   // Retrieve type of mnemonic (e.g., value/offset)
-                break;
-            }
+    // Work out the word for one line record; returns false for lines that generate no code
+    bool encodeLine(const LineRecords &lines, int r, uint32_t &word) {
+        // Extract mnemonic and operand for the current line
+        string_view operand = lines.operand[r];
+        int program_counter = lines.programCounter[r], type = -1, opcode = -1;
+        // The mnemonic's entry in opcodeTable gives its type and corresponding opcode
+        if (const OpcodeInfo* info = lines.info(r)) {
+            opcode = info->opcode;  // Retrieve opcode
+            type = info->type;      // Retrieve type of mnemonic (e.g., value/offset)
         }
-        string machineCode = "        ";  // Default empty machine code to start with
+        // The operand's symbol was looked up when the line was merged into the symbol table
+        int index = lines.symbolIndex[r];
         // If the mnemonic type requires an offset (e.g., branch instructions)
         if (type == 2) {  
             int offset = -1;
-            bool found = false;
-            // Look for the label in symbolTable to calculate the offset
-            for (const auto& sym : symbolTable) {
-                if (sym.first == operand) {
-                    offset = sym.second.first - (program_counter + 1);  // Calculate offset based on symbol's address
-                    found = true;
-                    break;
-                }
-            }
-            // If label not found, treat the operand as an immediate value
-            if (!found) {
-                offset = stoi(operand);  // Convert operand to an integer if it's not a label
+            if (index != -1 && symbolTable[index].address == -1) {
+                offset = 0;  // Label of another object (-c): the linker fills in the offset
+            } else if (index != -1) {
+                offset = symbolTable[index].address - (program_counter + 1);  // Calculate offset based on symbol's address
+            } else {
+                // If label not found, treat the operand as an immediate value
+                offset = toInt(operand);  // Convert operand to an integer if it's not a label
             }
-            // Convert the offset to hexadecimal and concatenate with the opcode
-            machineCode = converter.decToHex(offset).substr(2) + opcode;
+            // Place the offset above the opcode
+            word = encodeWord(offset, opcode);
         }
         // If mnemonic requires a value (e.g., arithmetic or memory instructions)
-        else if (type == 1 && mnemonic != "data" && mnemonic != "SET") {  
+        else if (type == 1 && opcode != -1) {  
             int value = -1;
-            bool found = false;
-            // Look for the label in symbolTable to retrieve its value
-            for (const auto& sym : symbolTable) {
-                if (sym.first == operand) {
-                    value = sym.second.first;  // Retrieve the value of the label from symbolTable
-                    found = true;
-                    break;
+            if (index != -1 && symbolTable[index].address == -1) {
+                value = 0;  // Label of another object (-c): the linker fills in its address
+            } else if (index != -1) {
+                value = symbolTable[index].address;  // Retrieve the value of the label from symbolTable
+                // If the operand is a variable in the SET operation, use its assigned value
+                if (symbolTable[index].isVariable) {
+                    value = toInt(symbolTable[index].value);
                 }
+            } else {
+                // If label is not found, treat the operand as an immediate value
+                value = toInt(operand);  // Convert operand to integer
             }
-            // If label is not found, treat the operand as an immediate value
-            if (!found) {
-                value = stoi(operand);  // Convert operand to integer
+            // Place the value above the opcode
+            word = encodeWord(value, opcode);
+        }
+        // For type 0 mnemonics (no operands, like "HALT"), just the opcode
+        else if (type == 0) {  
+            word = encodeWord(0, opcode);  // No operand, set to default zero with opcode
+        }
+        // Special case for "data" and "SET" instructions, where the operand is the whole word
+        else if (type == 1) {  
+            word = static_cast<uint32_t>(toInt(operand));
+        } else {
+            return false;  // Lines with only a label produce no word
+        }
+        return true;
+    }
+
+    // Encode the lines [begin, end) of lineRecords into their preallocated slots of machineCode and listingEntries
+    void encodeLines(int begin, int end) {
+        for (int lineIndex = begin; lineIndex < end; ++lineIndex) {
+            int program_counter = lineRecords.programCounter[lineIndex];
+            uint32_t word = 0;
+            bool hasCode;
+            int cached = cachedLineOfRecord.empty() ? -1 : cachedLineOfRecord[lineIndex];
+            if (cached != -1 && cachedWordIsValid(lineIndex, cachedLines[cached])) {
+                // Unchanged line whose operand still resolves the same way: reuse the cached word
+                hasCode = cachedLines[cached].flags & CACHED_HAS_CODE;
+                word = cachedLines[cached].word;
+            } else {
+                hasCode = encodeLine(lineRecords, lineIndex, word);
             }
-            // Convert the value to hexadecimal and concatenate with the opcode
-            machineCode = converter.decToHex(value).substr(2) + opcode;
+            // Every line that generates a word advanced the program counter by one, so its word goes at its own address
+            if (hasCode) machineCode[program_counter] = word;
+            listingEntries[lineIndex] = {lineIndex, hasCode ? program_counter : -1};
+        }
+    }
+
+    // Generating machine codes and building the listing vector
+    // Each line is encoded on its own, so chunks of lines are spread across the thread pool
+    void second_pass() {
+        int lineCount = lineRecords.size();
+        machineCode.assign(programSize, 0);
+        listingEntries.assign(lineCount, {0, -1});
+        int chunkCount = max(1, min(pool.size() * 4, lineCount / MIN_CHUNK_LINES));
+        pool.run(chunkCount, [&](int c) {
+            encodeLines((long long)lineCount * c / chunkCount, (long long)lineCount * (c + 1) / chunkCount);
+        });
+    }
 
-            // Check if operand is a variable in SET operation and use its assigned value
-            auto it = find_if(variableAssignments.begin(), variableAssignments.end(),
-                [&operand](const std::pair<std::string, std::string>& item) { 
-                    return item.first == operand; 
-                });
+    // One pass over the source ("--one-pass"): every line is checked, entered in the symbol table and encoded as
+    // soon as it is read, so neither the source nor its records are kept. A word whose operand label comes later
+    // is emitted with operand 0 and chained to the label; the definition patches the word and its place in the
+    // listing. The outputs are the same as those of the two passes, while memory grows with the words and symbols
+    // (and the errors of a failed build) rather than with the source
+    bool one_pass() {
+        LineReader reader;
+        if (!reader.open(sourcePath.c_str())) {
+            if (verbose) cout << "Input file doesn't exist" << endl;
+            inputMissing = true;
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+        // The listing is written next to its final name and only an error-free build moves it into place
+        string partialListing = listingPath + ".part";
+        if (writeListing) {
+            listingFile = ::open(partialListing.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            listingBuffer.reserve(LISTING_BUFFER_BYTES + 4096);
+        }
+        vector<string_view> lines;
+        int location_counter = 0, program_counter = 0;
+        size_t bytes = 0;
+        while (reader.nextBlock(lines)) {
+            ChunkResult block;
+            block.lines.reserve(lines.size());
+            for (string_view line : lines) {
+                analyseLine(line, ++location_counter, program_counter, block);
+                bytes += line.size() + 1;
+            }
+            emitBlock(block);
+        }
+        programSize = program_counter;
+        checkSymbols();
+        if (showTimings && verbose) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            printf("one pass: %.3f s, %.1f MB/s\n", seconds, bytes / seconds / 1e6);
+        }
+        show_warnings_and_errors();
+        if (errorList.empty()) {
+            if (listingFile != -1) {
+                flushListing();
+                patchListingFile();
+                ::close(listingFile);
+                rename(partialListing.c_str(), listingPath.c_str());
+                if (verbose) cout << "Listing (.lst) file generated" << endl;
+            }
+            // Labels still waiting for a definition are another object's (-c)
+            for (size_t index = 0; index < fixupHead.size(); ++index) {
+                for (int f = fixupHead[index]; f != -1; f = fixups[f].next) {
+                    addRelocation(wordRelocations, fixups[f].address, fixups[f].info, index);
+                }
+            }
+            sort(wordRelocations.begin(), wordRelocations.end(), [](const ObjectRelocation &a, const ObjectRelocation &b) {
+                return a.address < b.address;
+            });
+            writeObject(wordIsData, wordRelocations);
+            if (verbose) cout << "Machine code object (.o) file generated" << endl;
+        } else if (listingFile != -1) {
+            ::close(listingFile);
+            remove(partialListing.c_str());
+        }
+        return errorList.empty();
+    }
 
-            // If the operand is a variable in the SET operation, use its assigned value
-            if (it != variableAssignments.end()) {
-                machineCode = converter.decToHex(stoi(it->second)).substr(2) + opcode;
+    // Enter the lines of one block in the symbol table and emit their words and listing lines, in source order.
+    // Errors are placed exactly where first_pass puts them; after the first one nothing more is emitted
+    void emitBlock(ChunkResult &block) {
+        LineRecords &lines = block.lines;
+        size_t nextError = 0, nextEvent = 0;
+        for (int r = 0; r < (int)lines.size(); ++r) {
+            int line = lines.lineNum[r];
+            // Errors of earlier lines come first
+            while (nextError < block.errors.size() && block.errors[nextError].position < line) {
+                errorList.push_back(block.errors[nextError++]);
+            }
+            int fixup = -1;  // Fixup of the line's word when its operand label is not defined yet
+            if (nextEvent < block.events.size() && block.events[nextEvent].record == r) {
+                const LineEvent &event = block.events[nextEvent++];
+                int defined = event.definesLabel ? LabelProcessor(lines.label[r], event.labelHash, line, lines.programCounter[r]) : -1;
+                if (event.usesLabel) {
+                    int index = symbolTable.findOrInsert(lines.operand[r], event.operandHash, -1, line);
+                    lines.symbolIndex[r] = index;
+                    // Only whether a label is used matters afterwards, so just its first use is recorded
+                    if (symbolTable[index].firstReference == -1) symbolTable.addReference(index, line);
+                    if (symbolTable[index].address == -1) {
+                        fixup = addFixup(index, line, lines.programCounter[r], lines.info(r));
+                    }
+                }
+                if (event.assignsValue) {
+                    int index = symbolTable.find(lines.label[r], event.labelHash);
+                    if (index != -1 && !symbolTable[index].isVariable) {
+                        symbolTable[index].isVariable = true;
+                        symbolTable[index].value = recordText.store(lines.operand[r]);  // The block does not last
+                    }
+                }
+                // Only now is a SET label's value known
+                if (defined != -1) resolveFixups(defined);
+            }
+            // Then the line's own errors
+            while (nextError < block.errors.size() && block.errors[nextError].position == line) {
+                errorList.push_back(block.errors[nextError++]);
+            }
+            if (!errorList.empty()) continue;
+            uint32_t word = 0;
+            bool hasCode = encodeLine(lines, r, word);
+            if (hasCode) {
+                // Every word advanced the program counter by one, so it goes right after the previous one
+                const OpcodeInfo* info = lines.info(r);
+                machineCode.push_back(word);
+                wordIsData.push_back(info->opcode == -1);
+                // A defined label stays what it is; the relocation of a pending one waits for its definition
+                if (lines.symbolIndex[r] != -1 && fixup == -1) {
+                    addRelocation(wordRelocations, lines.programCounter[r], info, lines.symbolIndex[r]);
+                }
+            }
+            if (listingFile != -1) {
+                // The word follows the 8 digit address and a space
+                if (fixup != -1) fixups[fixup].listingOffset = listingWritten + listingBuffer.size() + 9;
+                appendListingLine(listingBuffer, lines, r, hasCode ? &word : nullptr);
+                listingBuffer += '\n';
+                if (listingBuffer.size() >= LISTING_BUFFER_BYTES) flushListing();
             }
         }
-        // For type 0 mnemonics (no operands, like "HALT"), just append the opcode
-        else if (type == 0) {  
-            machineCode = "000000" + opcode;  // No operand, set to default zero with opcode
+        errorList.insert(errorList.end(), block.errors.begin() + nextError, block.errors.end());
+    }
+
+    // Chain a fixup for the word at address to the (not yet defined) label at index and return it
+    int addFixup(int index, int line, int address, const OpcodeInfo* info) {
+        int f = freeFixups;
+        if (f != -1) {
+            freeFixups = fixups[f].next;
+            fixups[f] = {line, address, info, -1, -1};
+        } else {
+            f = fixups.size();
+            fixups.push_back({line, address, info, -1, -1});
         }
-        // Special case for "data" and "SET" instructions, where operand is directly converted
-        else if (type == 1 && (mnemonic == "data" || mnemonic == "SET")) {  
-            machineCode = converter.decToHex(stoi(operand));  // Convert the operand directly to hexadecimal
+        if (index >= (int)fixupHead.size()) {
+            fixupHead.resize(symbolTable.entries.size(), -1);
+            fixupTail.resize(symbolTable.entries.size(), -1);
         }
-        // Add the generated machine code to the list for later processing
-        machineCodeList.emplace_back(machineCode);
-        // Add the current program counter, machine code, label, mnemonic, and previous operand to the listing
-        add_in_list(program_counter, machineCode, label, mnemonic, prevOperand);
+        if (fixupHead[index] == -1) fixupHead[index] = f;
+        else fixups[fixupTail[index]].next = f;
+        fixupTail[index] = f;
+        return f;
+    }
+
+    // The label at index has just been defined: patch the words (and their listing entries) that were waiting
+    // for it, and put its fixups on the free list
+    void resolveFixups(int index) {
+        if (index >= (int)fixupHead.size() || fixupHead[index] == -1) return;
+        const SymbolEntry &symbol = symbolTable[index];
+        for (int f = fixupHead[index]; f != -1; f = fixups[f].next) {
+            const Fixup &fixup = fixups[f];
+            if (fixup.address >= (int)machineCode.size()) continue;  // Not emitted, there was an error
+            // The operand is worked out the way encodeLine does it for a defined label
+            int value = fixup.info->type == 2 ? symbol.address - (fixup.address + 1)
+                                              : symbol.isVariable ? toInt(symbol.value) : symbol.address;
+            uint32_t &word = machineCode[fixup.address];
+            word = encodeWord(value, word & 0xFF);
+            addRelocation(wordRelocations, fixup.address, fixup.info, index);
+            if (fixup.listingOffset != -1) patchListing(fixup.listingOffset, word);
+        }
+        fixups[fixupTail[index]].next = freeFixups;
+        freeFixups = fixupHead[index];
+        fixupHead[index] = fixupTail[index] = -1;
+    }
+
+    // Call f with the line of every pending fixup of the label at index, in the order they were added
+    template <class F> void forEachFixup(int index, F f) const {
+        if (index >= (int)fixupHead.size()) return;
+        for (int fixup = fixupHead[index]; fixup != -1; fixup = fixups[fixup].next) f(fixups[fixup].lineNum);
     }
-}
 
+    // Overwrite the word field at offset in the listing. Text already in the file is patched at the end, in
+    // order, rather than with one small write per word
+    void patchListing(long long offset, uint32_t word) {
+        if (offset < listingWritten) {
+            listingPatches.push_back({offset, word});
+            return;
+        }
+        char digits[16];
+        snprintf(digits, sizeof(digits), "%08X", word);
+        memcpy(&listingBuffer[offset - listingWritten], digits, 8);
+    }
 
+    // Apply listingPatches to the listing file, reading and rewriting it a buffer at a time around them
+    void patchListingFile() {
+        sort(listingPatches.begin(), listingPatches.end());
+        char digits[16];
+        for (size_t i = 0; i < listingPatches.size();) {
+            long long window = listingPatches[i].first;
+            size_t length = min<long long>(LISTING_BUFFER_BYTES, listingWritten - window);
+            listingBuffer.resize(length);
+            if (pread(listingFile, &listingBuffer[0], length, window) != (ssize_t)length) break;
+            // Every word field ends before the end of its line, so the first patch always fits
+            for (; i < listingPatches.size() && listingPatches[i].first + 8 <= window + (long long)length; ++i) {
+                snprintf(digits, sizeof(digits), "%08X", listingPatches[i].second);
+                memcpy(&listingBuffer[listingPatches[i].first - window], digits, 8);
+            }
+            if (pwrite(listingFile, listingBuffer.data(), length, window) != (ssize_t)length) break;
+        }
+        vector<pair<long long, uint32_t>>().swap(listingPatches);
+    }
 
-// Function to write errors and warnings into a .log file
-void show_warnings_and_errors() {
-    // Open a log file to write errors and warnings
-    ofstream coutErrors("logfile.log");
-    // Sort both error and warning lists based on line position for ordered output
-    sort(errorList.begin(), errorList.end());
-    sort(warningList.begin(), warningList.end());
-    // Notify user that the error log file has been generated
-    cout << "Errors (.log) file has been created." << endl;
-    // Check if there are any errors in errorList
-    if (errorList.empty()) {
-        // If no errors, write a "No errors!" message to the log file
-        coutErrors << "No errors found!!" << endl;
-        // Write all warnings to the log file, if any
-        for (auto warning : warningList) {
-            coutErrors << "Line Number:- " << warning.position << " WARNING:- " << warning.message << endl;
+    // Write the buffered listing text to listingFile
+    void flushListing() {
+        for (size_t done = 0; done < listingBuffer.size();) {
+            ssize_t put = ::write(listingFile, listingBuffer.data() + done, listingBuffer.size() - done);
+            if (put <= 0) break;
+            done += put;
         }
-        // Close the file and return since there are no errors to write
+        listingWritten += listingBuffer.size();
+        listingBuffer.clear();
+    }
+
+
+
+    // Function to write errors and warnings into a .log file
+    void show_warnings_and_errors() {
+        // Open a log file to write errors and warnings
+        ofstream coutErrors(logPath);
+        // Sort both error and warning lists based on line position for ordered output
+        sort(errorList.begin(), errorList.end());
+        sort(warningList.begin(), warningList.end());
+        // Notify user that the error log file has been generated
+        if (verbose) cout << "Errors (.log) file has been created." << endl;
+        // Check if there are any errors in errorList
+        if (errorList.empty()) {
+            // If no errors, write a "No errors!" message to the log file
+            coutErrors << "No errors found!!" << endl;
+            // Write all warnings to the log file, if any
+            for (const auto &warning : warningList) {
+                coutErrors << "Line Number:- " << warning.position << " WARNING:- " << warning.message << endl;
+            }
+            // Close the file and return since there are no errors to write
+            coutErrors.close();
+            return;
+        }
+        // If errors are present, write each error to the log file
+        for (const auto &error : errorList) {
+            coutErrors << "Line Number:- " << error.position << " ERROR:- " << error.message << endl;
+        }
+        // Close the log file after writing all errors (and warnings if any)
         coutErrors.close();
-        return;
     }
-    // If errors are present, write each error to the log file
-    for (auto error : errorList) {
-        coutErrors << "Line Number:- " << error.position << " ERROR:- " << error.message << endl;
+
+
+    // Reading from the input file
+    // Function to map the source file and split it into lines without copying them; returns false if it does not exist
+    bool readFile() {
+        // Check if file opening failed
+        if (!sourceFile.open(sourcePath.c_str())) {
+            if (verbose) cout << "Input file doesn't exist" << endl;  // Print error message if file is not found
+            return false;
+        }
+
+        // Split at each '\n'; a last line without a newline still counts as a line
+        string_view text = sourceFile.text();
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == string_view::npos) end = text.size();
+            readLines.push_back(text.substr(start, end - start));  // Add each line to the readLines vector
+            start = end + 1;
+        }
+        return true;
     }
-    // Close the log file after writing all errors (and warnings if any)
-    coutErrors.close();
-}
 
 
-vector<string> readLines; 		// stores each line 
+    // Function to write listing information to a .lst file and machine code to a .o binary file
+    void writeFile() {
+        if (writeListing) {
+            // Format the listing lines into a buffer: address, machine code (blank if none) and the statement.
+            // The buffer is written out whenever it passes LISTING_BUFFER_BYTES, so it never holds the whole file
+            ofstream coutList(listingPath, ios::binary);  // Create an output file stream for the .lst file
+            string listing;
+            listing.reserve(LISTING_BUFFER_BYTES + 4096);
+            for (const auto &entry : listingEntries) {
+                appendListingLine(listing, lineRecords, entry.lineIndex, entry.wordIndex != -1 ? &machineCode[entry.wordIndex] : nullptr);
+                if (!optimizerNotes.empty() && !optimizerNotes[entry.lineIndex].empty()) {
+                    listing += "  ; " + optimizerNotes[entry.lineIndex];
+                }
+                listing += '\n';
+                if (listing.size() >= LISTING_BUFFER_BYTES) {
+                    coutList.write(listing.data(), listing.size());
+                    listing.clear();
+                }
+            }
+            coutList.write(listing.data(), listing.size());
+            coutList.close();  // Close the .lst file after writing all entries
+            if (verbose) cout << "Listing (.lst) file generated" << endl;
+        }
+        writeObject();
+        if (verbose) cout << "Machine code object (.o) file generated" << endl;
+    }
 
-// Reading from the input file
-// Function to read lines from "bubbleSort.txt" file and store them in readLines vector
-void readFile() {
-    ifstream cinfile;  // Create an input file stream
-    cinfile.open("fib.txt");  // Open the file "bubbleSort.txt" for reading
+    // Append the listing line of record r without its newline: address, word (blank if word is null) and statement
+    static void appendListingLine(string &listing, const LineRecords &lines, int r, const uint32_t* word) {
+        char field[32];
+        if (word) {
+            snprintf(field, sizeof(field), "%08X %08X ", lines.programCounter[r], *word);
+        } else {
+            snprintf(field, sizeof(field), "%08X          ", lines.programCounter[r]);
+        }
+        listing += field;
+        // Combine label, mnemonic, and operand to form the complete source line statement
+        if (!lines.label[r].empty()) listing.append(lines.label[r]).append(": ");
+        if (lines.mnemonic[r] != -1) listing.append(lines.instruction(r)).append(" ");
+        listing += lines.previousOperand[r];
+    }
 
-    // Check if file opening failed
-    if (cinfile.fail()) {
-        cout << "Input file doesn't exist" << endl;  // Print error message if file is not found
-        exit(0);  // Exit the program
+    // Add the relocation the word at pc needs for its operand label (offsets to labels of the same object
+    // and SET values need none)
+    void addRelocation(vector<ObjectRelocation> &relocations, uint32_t pc, const OpcodeInfo* info, int index) {
+        const SymbolEntry &symbol = symbolTable[index];
+        bool external = symbol.address == -1;
+        if (info->type == 2 && external) {
+            // Offsets to labels of the same object do not change when it moves
+            relocations.push_back({pc, RELOC_RELATIVE, index});
+        } else if (info->type == 1 && info->opcode != -1 && !symbol.isVariable) {
+            relocations.push_back({pc, RELOC_ABSOLUTE, external ? index : -1});
+        }
     }
 
-    string curLine;
-    // Read each line from the file until end of file is reached
-    while (getline(cinfile, curLine)) {
-        readLines.push_back(curLine);  // Add each line to the readLines vector
+    // Write the object file of the line records
+    void writeObject() {
+        vector<char> isData(programSize, 0);
+        vector<ObjectRelocation> relocations;
+        for (size_t r = 0; r < lineRecords.size(); ++r) {
+            if (listingEntries[r].wordIndex == -1) continue;
+            const OpcodeInfo* info = lineRecords.info(r);
+            uint32_t pc = lineRecords.programCounter[r];
+            if (info->opcode == -1) isData[pc] = 1;
+            if (lineRecords.symbolIndex[r] != -1) addRelocation(relocations, pc, info, lineRecords.symbolIndex[r]);
+        }
+        writeObject(isData, relocations);
     }
 
-    cinfile.close();  // Close the file after reading all lines
-}
+    // Write the object file: machine code split into code and data sections (isData marks the data words), every
+    // label as a symbol and a relocation for each operand that depends on where the object or another object's
+    // label ends up
+    void writeObject(const vector<char> &isData, const vector<ObjectRelocation> &relocations) {
+        // The symbols are the entries of the symbol table, in the same order
+        vector<ObjectSymbol> symbols;
+        string strings;
+        symbols.reserve(symbolTable.entries.size());
+        for (const SymbolEntry &symbol : symbolTable.entries) {
+            uint32_t flags = (symbol.address != -1 ? SYMBOL_DEFINED : 0) | (symbol.isVariable ? SYMBOL_ABSOLUTE : 0);
+            int32_t value = symbol.isVariable ? toInt(symbol.value) : symbol.address;
+            symbols.push_back({(uint32_t)strings.size(), (uint32_t)symbol.label.size(), value, flags});
+            strings += symbol.label;
+        }
+        strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+        vector<ObjectSection> sections;
+        for (int address = 0; address < programSize; ++address) {
+            uint32_t kind = isData[address] ? SECTION_DATA : SECTION_CODE;
+            if (sections.empty() || sections.back().kind != kind) {
+                sections.push_back({kind, (uint32_t)address, 0, 0});
+            }
+            ++sections.back().wordCount;
+        }
+        size_t wordsAt = sizeof(ObjectHeader) + sections.size() * sizeof(ObjectSection)
+                         + symbols.size() * sizeof(ObjectSymbol) + relocations.size() * sizeof(ObjectRelocation)
+                         + strings.size();
+        for (auto &section : sections) section.offset = wordsAt + section.address * sizeof(uint32_t);
+        ObjectHeader header = {OBJECT_MAGIC, (uint32_t)programSize, (uint32_t)sections.size(), (uint32_t)symbols.size(),
+                               (uint32_t)relocations.size(), (uint32_t)strings.size()};
+        // Every word belongs to exactly one section, in address order, so the words are written in one piece
+        ofstream out(objectPath, ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(ObjectSection));
+        out.write(reinterpret_cast<const char*>(symbols.data()), symbols.size() * sizeof(ObjectSymbol));
+        out.write(reinterpret_cast<const char*>(relocations.data()), relocations.size() * sizeof(ObjectRelocation));
+        out.write(strings.data(), strings.size());
+        out.write(reinterpret_cast<const char*>(machineCode.data()), machineCode.size() * sizeof(uint32_t));
+    }
 
+    // FNV-1a hash (64 bit) of every source line
+    void hashLines() {
+        lineHashes.resize(readLines.size());
+        pool.run(pool.size(), [&](int t) {
+            size_t begin = readLines.size() * t / pool.size(), end = readLines.size() * (t + 1) / pool.size();
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t hash = 14695981039346656037ull;
+                for (unsigned char ch : readLines[i]) hash = (hash ^ ch) * 1099511628211ull;
+                lineHashes[i] = hash;
+            }
+        });
+    }
 
-// Function to write listing information to a .lst file and machine code to a .o binary file
-void writeFile() {
-    // Write listing information to .lst file
-    ofstream coutList("listfile.lst");  // Create an output file stream for the .lst file
-    for (auto entry : listingEntries) {
-        // Write each entry with address, machine code, and statement to the .lst file
-        coutList << entry.address << " " << entry.machineCode << " " << entry.statement << endl;
+    // First pass from the cache: lines before and after the edited region are replayed, only the region is analysed.
+    // Returns false (leaving everything untouched) when there is no usable cache, the edit adds, removes or
+    // renames a label definition or it introduces an error; a full first pass is needed then
+    bool incrementalFirstPass() {
+        if (!cacheFile.open(cachePath.c_str())) return false;
+        string_view file = cacheFile.text();
+        if (file.size() < sizeof(CacheHeader)) return false;
+        CacheHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+        size_t linesAt = sizeof(CacheHeader), symbolsAt = linesAt + (size_t)header.lineCount * sizeof(CachedLine);
+        size_t referencesAt = symbolsAt + (size_t)header.symbolCount * sizeof(CachedSymbol);
+        size_t textAt = referencesAt + (size_t)header.referenceCount * sizeof(int32_t);
+        if (header.magic != CACHE_MAGIC || textAt + header.textSize != file.size()) return false;
+        cachedLines = reinterpret_cast<const CachedLine*>(file.data() + linesAt);
+        const CachedSymbol* cachedSymbols = reinterpret_cast<const CachedSymbol*>(file.data() + symbolsAt);
+        const int32_t* cachedReferences = reinterpret_cast<const int32_t*>(file.data() + referencesAt);
+        const char* cacheText = file.data() + textAt;
+
+        // The edited region: old lines [head, oldCount - tail) became new lines [head, newCount - tail)
+        int oldCount = header.lineCount, newCount = readLines.size(), head = 0, tail = 0;
+        while (head < oldCount && head < newCount && cachedLines[head].hash == lineHashes[head]) ++head;
+        while (tail < oldCount - head && tail < newCount - head
+               && cachedLines[oldCount - 1 - tail].hash == lineHashes[newCount - 1 - tail]) ++tail;
+        int oldEnd = oldCount - tail, newEnd = newCount - tail;
+        auto oldPC = [&](int line) { return line < oldCount ? cachedLines[line].programCounter : header.programSize; };
+        ChunkResult region;
+        int program_counter = oldPC(head);
+        for (int i = head; i < newEnd; ++i) {
+            analyseLine(readLines[i], i + 1, program_counter, region);
+        }
+        if (!region.errors.empty()) return false;
+        // The region must define the same labels as before, in the same order (they may move or change value)
+        int nextDefinition = head;
+        for (const auto &event : region.events) {
+            if (!event.definesLabel) continue;
+            while (nextDefinition < oldEnd && !(cachedLines[nextDefinition].flags & CACHED_DEFINES_LABEL)) ++nextDefinition;
+            if (nextDefinition == oldEnd) return false;
+            const CachedLine &entry = cachedLines[nextDefinition++];
+            if (region.lines.label[event.record] != string_view(cacheText + entry.textOffset, entry.labelLength)) return false;
+        }
+        while (nextDefinition < oldEnd && !(cachedLines[nextDefinition].flags & CACHED_DEFINES_LABEL)) ++nextDefinition;
+        if (nextDefinition != oldEnd) return false;  // A definition was removed
+        int lineShift = newEnd - oldEnd, pcShift = program_counter - oldPC(oldEnd);
+
+        // Restore the symbol table, moving the labels defined after the region
+        SymbolTable restored;
+        restored.reserve(header.symbolCount);
+        previousAddress.resize(header.symbolCount);
+        for (uint32_t s = 0; s < header.symbolCount; ++s) {
+            const CachedSymbol &cached = cachedSymbols[s];
+            string_view label(cacheText + cached.labelOffset, cached.labelLength);
+            bool after = cached.lineNum > oldEnd;
+            // A label left to the linker (-c) has no address to move
+            int address = cached.address == -1 ? -1 : cached.address + (after ? pcShift : 0);
+            int index = restored.insert(label, SymbolTable::hashLabel(label), address, cached.lineNum + (after ? lineShift : 0));
+            restored[index].isVariable = cached.isVariable;
+            restored[index].value = string_view(cacheText + cached.valueOffset, cached.valueLength);
+            previousAddress[index] = cached.address;
+        }
+        // Labels defined in the region take their new place and value; labels used in it must be defined
+        redefinedSymbol.assign(header.symbolCount, false);
+        vector<pair<int, int>> regionReferences;  // {symbol, line}
+        LineRecords &lines = region.lines;
+        for (const auto &event : region.events) {
+            int r = event.record;
+            if (event.definesLabel) {
+                int index = restored.find(lines.label[r], event.labelHash);
+                restored[index].address = lines.programCounter[r];
+                restored[index].lineNum = event.lineNum;
+                restored[index].isVariable = event.assignsValue;
+                restored[index].value = event.assignsValue ? lines.operand[r] : string_view();
+                redefinedSymbol[index] = true;
+            }
+            if (!event.usesLabel) continue;
+            lines.symbolIndex[r] = restored.find(lines.operand[r], event.operandHash);
+            if (lines.symbolIndex[r] == -1) return false;
+            regionReferences.push_back({lines.symbolIndex[r], event.lineNum});
+        }
+        sort(regionReferences.begin(), regionReferences.end());
+        // References keep their order: those before the region, those in it, then the moved ones after it
+        size_t nextReference = 0;
+        for (uint32_t s = 0; s < header.symbolCount; ++s) {
+            const int32_t* first = cachedReferences + cachedSymbols[s].firstReference;
+            const int32_t* last = first + cachedSymbols[s].referenceCount;
+            for (; first != last && *first <= head; ++first) restored.addReference(s, *first);
+            for (; nextReference < regionReferences.size() && regionReferences[nextReference].first == (int)s; ++nextReference) {
+                restored.addReference(s, regionReferences[nextReference].second);
+            }
+            for (; first != last; ++first) {
+                if (*first > oldEnd) restored.addReference(s, *first + lineShift);
+            }
+        }
+        // A full pass enters every symbol where it first appears (a definition ahead of a use on the same line)
+        // and never one that is neither defined nor used. If the edit changed the order or left such a symbol,
+        // the restored table would not be the one a full pass builds, so it has to run instead
+        long long previousKey = -1;
+        for (uint32_t s = 0; s < header.symbolCount; ++s) {
+            SymbolEntry &symbol = restored[s];
+            int firstUse = restored.firstReferenceLine(s);
+            if (symbol.address == -1) {
+                if (firstUse == -1) return false;
+                symbol.lineNum = firstUse;  // Where a full pass adds the placeholder
+            }
+            long long key = symbol.address != -1 ? 2LL * symbol.lineNum : 2LL * firstUse + 1;
+            if (firstUse != -1) key = min(key, 2LL * firstUse + 1);
+            if (key <= previousKey) return false;
+            previousKey = key;
+        }
+
+        // Records and comments of the whole file, in order; every replayed line has its slot worked out first
+        // so the records can be rebuilt in parallel
+        vector<pair<int, int>> replayed;  // {new line, record index} of the lines that have a record
+        replayed.reserve(newCount);
+        cachedLineOfRecord.reserve(newCount);
+        auto place = [&](int oldLine, int newLine) {
+            const CachedLine &entry = cachedLines[oldLine];
+            if (entry.commentOffset != -1) {
+                commentLines.push_back({newLine + 1, readLines[newLine].substr(entry.commentOffset)});
+            }
+            if (entry.flags & CACHED_HAS_RECORD) {
+                replayed.push_back({newLine, (int)cachedLineOfRecord.size()});
+                cachedLineOfRecord.push_back(oldLine);
+            }
+        };
+        for (int i = 0; i < head; ++i) place(i, i);
+        commentLines.insert(commentLines.end(), region.comments.begin(), region.comments.end());
+        int regionRecords = cachedLineOfRecord.size();
+        cachedLineOfRecord.resize(regionRecords + region.lines.size(), -1);
+        for (int i = newEnd; i < newCount; ++i) place(i - lineShift, i);
+        lineRecords.resize(cachedLineOfRecord.size());
+        lineRecords.place(regionRecords, region.lines);
+        recordText.splice(region.text);
+        int replayCount = replayed.size(), chunkCount = max(1, min(pool.size() * 4, replayCount / MIN_CHUNK_LINES));
+        pool.run(chunkCount, [&](int c) {
+            for (int r = (long long)replayCount * c / chunkCount; r < (long long)replayCount * (c + 1) / chunkCount; ++r) {
+                // The text fields are spans of the mapped cache file, which stays open for the whole job
+                int newLine = replayed[r].first, record = replayed[r].second;
+                const CachedLine &entry = cachedLines[cachedLineOfRecord[record]];
+                const char* text = cacheText + entry.textOffset;
+                lineRecords.programCounter[record] = entry.programCounter + (newLine < head ? 0 : pcShift);
+                lineRecords.label[record] = string_view(text, entry.labelLength);
+                text += entry.labelLength;
+                lineRecords.mnemonic[record] = mnemonicId(string_view(text, entry.instructionLength));
+                text += entry.instructionLength;
+                lineRecords.operand[record] = string_view(text, entry.operandLength);
+                text += entry.operandLength;
+                lineRecords.previousOperand[record] = string_view(text, entry.previousOperandLength);
+                lineRecords.lineNum[record] = newLine + 1;
+                lineRecords.symbolIndex[record] = entry.symbolIndex;
+            }
+        });
+        programSize = header.programSize + pcShift;
+        symbolTable = move(restored);
+        checkSymbols();
+        return true;
     }
-    coutList.close();  // Close the .lst file after writing all entries
-    cout << "Listing (.lst) file generated" << endl;
-    // Write machine code to .o binary file
-    ofstream coutMCode;
-    coutMCode.open("machineCode.o", ios::binary | ios::out);  // Open the .o file in binary write mode
-    for (auto code : machineCodeList) {
-        // Skip empty or placeholder machine codes
-        if (code.empty() || code == "        ") continue;
 
-        // Convert hex string to an unsigned integer for binary writing
-        unsigned int machineCode = static_cast<unsigned int>(stoi(converter.hexToDec(code)));
+    // Write the cache file for this (error-free) build; it replaces the old one only once it is complete
+    void saveCache() {
+        CacheHeader header = {CACHE_MAGIC, (uint32_t)readLines.size(), (uint32_t)symbolTable.entries.size(), 0, 0, programSize, 0};
+        vector<CachedLine> lines(readLines.size());
+        vector<CachedSymbol> symbols(symbolTable.entries.size());
+        vector<int32_t> references;
+        string text;
+        size_t record = 0, comment = 0;
+        int program_counter = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            CachedLine &entry = lines[i];
+            entry = {lineHashes[i], program_counter, 0, -1, -1, 0, 0, 0, 0, 0, 0};
+            if (comment < commentLines.size() && commentLines[comment].first == (int)i + 1) {
+                entry.commentOffset = commentLines[comment++].second.data() - readLines[i].data();
+            }
+            if (record < lineRecords.size() && lineRecords.lineNum[record] == (int)i + 1) {
+                string_view label = lineRecords.label[record], instruction = lineRecords.instruction(record);
+                string_view operand = lineRecords.operand[record], previousOperand = lineRecords.previousOperand[record];
+                entry.flags = CACHED_HAS_RECORD | (label.empty() ? 0 : CACHED_DEFINES_LABEL);
+                if (listingEntries[record].wordIndex != -1) {
+                    entry.flags |= CACHED_HAS_CODE;
+                    entry.word = machineCode[lineRecords.programCounter[record]];
+                    program_counter = lineRecords.programCounter[record] + 1;
+                }
+                entry.symbolIndex = lineRecords.symbolIndex[record];
+                entry.textOffset = text.size();
+                entry.labelLength = label.size();
+                entry.instructionLength = instruction.size();
+                entry.operandLength = operand.size();
+                entry.previousOperandLength = previousOperand.size();
+                text += label;
+                text += instruction;
+                text += operand;
+                text += previousOperand;
+                ++record;
+            }
+        }
+        for (size_t s = 0; s < symbols.size(); ++s) {
+            const SymbolEntry &symbol = symbolTable.entries[s];
+            uint32_t firstReference = references.size();
+            symbolTable.forEachReference(s, [&references](int line) { references.push_back(line); });
+            symbols[s] = {(uint32_t)text.size(), (uint32_t)symbol.label.size(), (uint32_t)(text.size() + symbol.label.size()),
+                          (uint32_t)symbol.value.size(), symbol.address, symbol.lineNum, firstReference,
+                          (uint32_t)(references.size() - firstReference), symbol.isVariable};
+            text += symbol.label;
+            text += symbol.value;
+        }
+        header.referenceCount = references.size();
+        header.textSize = text.size();
+        string temporary = cachePath + ".tmp";
+        ofstream out(temporary, ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(lines.data()), lines.size() * sizeof(CachedLine));
+        out.write(reinterpret_cast<const char*>(symbols.data()), symbols.size() * sizeof(CachedSymbol));
+        out.write(reinterpret_cast<const char*>(references.data()), references.size() * sizeof(int32_t));
+        out.write(text.data(), text.size());
+        out.close();
+        if (out) rename(temporary.c_str(), cachePath.c_str());
+    }
+};
 
-        // Write the binary representation of machineCode to the .o file
-        coutMCode.write(reinterpret_cast<const char*>(&machineCode), sizeof(unsigned int));
+// "asm --link": places object files one after another in a single pass over them. A relocation whose
+// symbol is already known is applied as its object is read; the others are kept as fixups and patched once
+// every object has been seen, so no object is read twice. The output is an object without relocations
+class Linker {
+public:
+    // Append the object at path; returns false (after reporting why) if it cannot be linked
+    bool add(const string &path) {
+        SourceFile file;
+        if (!file.open(path.c_str())) return fail(path + ": cannot open");
+        string_view data = file.text();
+        ObjectHeader header;
+        if (data.size() < sizeof(header)) return fail(path + ": not an object file");
+        memcpy(&header, data.data(), sizeof(header));
+        size_t symbolsAt = sizeof(header) + (size_t)header.sectionCount * sizeof(ObjectSection);
+        size_t relocationsAt = symbolsAt + (size_t)header.symbolCount * sizeof(ObjectSymbol);
+        size_t stringsAt = relocationsAt + (size_t)header.relocationCount * sizeof(ObjectRelocation);
+        if (header.magic != OBJECT_MAGIC || stringsAt + header.stringBytes > data.size()) {
+            return fail(path + ": not an object file");
+        }
+        // The views may be unaligned for the structures, so every record is copied out
+        auto record = [&](auto &value, size_t at) { memcpy(&value, data.data() + at, sizeof(value)); };
+        uint32_t base = image.size();
+        image.resize(base + header.imageWords, 0);
+        for (uint32_t i = 0; i < header.sectionCount; ++i) {
+            ObjectSection section;
+            record(section, sizeof(header) + i * sizeof(section));
+            if ((uint64_t)section.address + section.wordCount > header.imageWords
+                || (uint64_t)section.offset + section.wordCount * sizeof(uint32_t) > data.size()) {
+                return fail(path + ": section out of bounds");
+            }
+            memcpy(&image[base + section.address], data.data() + section.offset, section.wordCount * sizeof(uint32_t));
+            section.address += base;
+            sections.push_back(section);
+        }
+        // Symbols of the object as indices into the linker's table
+        vector<int> global(header.symbolCount);
+        for (uint32_t i = 0; i < header.symbolCount; ++i) {
+            ObjectSymbol symbol;
+            record(symbol, symbolsAt + i * sizeof(symbol));
+            if ((uint64_t)symbol.nameOffset + symbol.nameLength > header.stringBytes) return fail(path + ": bad symbol name");
+            string name(data.data() + stringsAt + symbol.nameOffset, symbol.nameLength);
+            int index = global[i] = symbols.findOrInsert(name, SymbolTable::hashLabel(name), -1, -1);
+            if (!(symbol.flags & SYMBOL_DEFINED)) continue;
+            SymbolEntry &entry = symbols[index];
+            if (entry.lineNum != -1) return fail("duplicate symbol " + name + " in " + objects[entry.lineNum] + " and " + path);
+            entry.isVariable = symbol.flags & SYMBOL_ABSOLUTE;
+            entry.address = symbol.value + (entry.isVariable ? 0 : base);
+            entry.lineNum = objects.size();
+        }
+        for (uint32_t i = 0; i < header.relocationCount; ++i) {
+            ObjectRelocation relocation;
+            record(relocation, relocationsAt + i * sizeof(relocation));
+            if (relocation.address >= header.imageWords || relocation.symbol >= (int32_t)header.symbolCount) {
+                return fail(path + ": bad relocation");
+            }
+            uint32_t address = base + relocation.address;
+            if (relocation.symbol < 0) {
+                image[address] = relocateWord(image[address], base);
+            } else if (symbols[global[relocation.symbol]].lineNum != -1) {
+                apply(global[relocation.symbol], address, relocation.kind);
+            } else {
+                fixups.push_back({global[relocation.symbol], address, relocation.kind});
+            }
+            ++relocationCount;
+        }
+        objects.push_back(path);
+        return true;
+    }
+
+    // Patch the fixups and write the linked object to path; returns false if a symbol is still undefined
+    bool finish(const string &path) {
+        for (const Fixup &fixup : fixups) {
+            if (symbols[fixup.symbol].lineNum != -1) {
+                apply(fixup.symbol, fixup.address, fixup.kind);
+            } else if (symbols[fixup.symbol].firstReference == -1) {
+                symbols.addReference(fixup.symbol, fixup.address);  // Reported once per symbol
+                fail("undefined symbol " + string(symbols[fixup.symbol].label));
+            }
+        }
+        if (failed) return false;
+        vector<ObjectSymbol> table;
+        string strings;
+        for (const SymbolEntry &entry : symbols.entries) {
+            if (entry.lineNum == -1) continue;
+            uint32_t flags = SYMBOL_DEFINED | (entry.isVariable ? SYMBOL_ABSOLUTE : 0);
+            table.push_back({(uint32_t)strings.size(), (uint32_t)entry.label.size(), entry.address, flags});
+            strings += entry.label;
+        }
+        strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+        size_t wordsAt = sizeof(ObjectHeader) + sections.size() * sizeof(ObjectSection) + table.size() * sizeof(ObjectSymbol)
+                         + strings.size();
+        for (auto &section : sections) section.offset = wordsAt + section.address * sizeof(uint32_t);
+        ObjectHeader header = {OBJECT_MAGIC, (uint32_t)image.size(), (uint32_t)sections.size(), (uint32_t)table.size(), 0,
+                               (uint32_t)strings.size()};
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(ObjectSection));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(ObjectSymbol));
+        out.write(strings.data(), strings.size());
+        out.write(reinterpret_cast<const char*>(image.data()), image.size() * sizeof(uint32_t));
+        out.close();
+        if (!out) return fail(path + ": cannot write");
+        printf("%zu object(s), %zu word(s), %zu symbol(s), %lld relocation(s) (%zu forward)\n", objects.size(),
+               image.size(), table.size(), relocationCount, fixups.size());
+        return true;
     }
-    coutMCode.close();  // Close the .o file after writing all machine codes
-    cout << "Machine code object (.o) file generated" << endl;
+
+private:
+    struct Fixup {
+        int symbol;               // Index into symbols
+        uint32_t address;         // Word to patch
+        uint32_t kind;
+    };
+    vector<uint32_t> image;           // The linked program
+    vector<ObjectSection> sections;   // Sections of every object, moved to their place in image
+    SymbolTable symbols;              // Every symbol seen: address is its final value, lineNum the object that
+                                      // defined it (-1 while undefined), isVariable marks SET values
+    vector<Fixup> fixups;             // Relocations against symbols that were undefined when they were read
+    vector<string> objects;           // Paths of the objects added so far
+    long long relocationCount = 0;
+    bool failed = false;
+
+    bool fail(const string &message) {
+        cerr << "link: " << message << endl;
+        failed = true;
+        return false;
+    }
+    void apply(int symbol, uint32_t address, uint32_t kind) {
+        int value = symbols[symbol].address;
+        image[address] = relocateWord(image[address], kind == RELOC_RELATIVE ? value - (int)(address + 1) : value);
+    }
+};
+
+// "asm --scan-bench <source>": how fast each scanner this processor supports splits the file into words and
+// classifies them; the checksums must agree
+int scanBenchmark(const char* path) {
+    SourceFile file;
+    if (!file.open(path)) {
+        cerr << "Input file doesn't exist" << endl;
+        return 1;
+    }
+    vector<string_view> lines;
+    string_view text = file.text();
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == string_view::npos) end = text.size();
+        lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    printf("%s: %zu line(s), %.1f MB\n", path, lines.size(), text.size() / 1e6);
+    const ScanImplementation* selected = scanner;
+    for (const ScanImplementation &implementation : scanImplementations) {
+        if (!scannerSupported(implementation)) continue;
+        scanner = &implementation;
+        uint64_t checksum = 0;
+        int passes = 0;
+        auto start = chrono::steady_clock::now();
+        double seconds = 0;
+        // Repeat the whole file until the measurement is long enough to trust
+        do {
+            checksum = 0;
+            LineTokens tokens;
+            for (string_view line : lines) {
+                tokenizeLine(line, tokens);
+                checksum = checksum * 31 + tokens.count + tokens.comment.size();
+                for (int i = 0; i < min(tokens.count, 3); ++i) checksum = checksum * 31 + classifyToken(tokens.token[i]);
+            }
+            ++passes;
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        } while (seconds < 0.5);
+        printf("%-6s %9.1f MB/s  (%d pass(es), checksum %016llx)\n", implementation.name, text.size() * passes / seconds / 1e6, passes, (unsigned long long)checksum);
+    }
+    scanner = selected;
+    return 0;
 }
 
-int main() {
-   readFile();
-   fillOpcodeTable();
-   first_pass(readLines);
-   show_warnings_and_errors();
-   if(errorList.empty()){
-    second_pass();
-    writeFile();
+int main(int argc, char* argv[]) {
+   // "--no-lst" skips formatting and writing the listing file, "--threads N" sets how many threads the passes use,
+   // "--timings" reports how long each pass took, "--incremental" reuses and updates the build cache, "-c" leaves
+   // labels that are not defined in the file to the linker, "-O" optimizes the program before encoding it,
+   // "--one-pass" assembles in a single pass over the source, backpatching forward references.
+   // Without source files fib.txt is assembled into logfile.log, listfile.lst and machineCode.o; with them
+   // ("asm a.asm b.asm ... -j N") every file gets its own outputs and N files are assembled at a time.
+   // "asm --link out.o a.o b.o ..." links object files into one; "asm --scan-bench src.asm" times the scanners
+   if (argc > 2 && string(argv[1]) == "--scan-bench") return scanBenchmark(argv[2]);
+   if (argc > 1 && string(argv[1]) == "--link") {
+       if (argc < 4) {
+           cerr << "Usage: asm --link <output> <objects...>" << endl;
+           return 1;
+       }
+       Linker linker;
+       bool linked = true;
+       for (int i = 3; i < argc; ++i) linked &= linker.add(argv[i]);
+       return linked && linker.finish(argv[2]) ? 0 : 1;
    }
-   return 0;
+   const char* usage = "Usage: asm [--no-lst] [--threads N | -j N] [--timings] [--incremental] [-c] [-O] [--one-pass] [sources...]";
+   vector<string> sources;
+   for (int i = 1; i < argc; ++i) {
+       string option = argv[i];
+       if (option == "--no-lst") writeListing = false;
+       else if (option == "-c") relocatableMode = true;
+       else if (option == "-O") optimizeMode = true;
+       else if (option == "--threads" || option == "-j") {
+           char* end = nullptr;
+           long count = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+           if (i + 1 >= argc || *end != '\0' || end == argv[i + 1]) {
+               cerr << option << " needs a number of threads" << endl << usage << endl;
+               return 1;
+           }
+           threadCount = max(1L, count);
+           ++i;
+       }
+       else if (option == "--timings") showTimings = true;
+       else if (option == "--incremental") incrementalMode = true;
+       else if (option == "--one-pass") onePassMode = true;
+       else if (option[0] == '-') {
+           // A misspelled option would otherwise be taken for a source file
+           cerr << "Unknown option: " << option << endl << usage << endl;
+           return 1;
+       }
+       else sources.push_back(option);
+   }
+   if (optimizeMode) incrementalMode = false;  // The cache holds lines as written, not as optimized
+   // The optimizer and the cache work on every line of the program, which a one-pass build never holds
+   if (optimizeMode || incrementalMode) onePassMode = false;
+   ThreadPool pool(threadCount);
+   if (sources.empty()) {
+       Assembler job("fib.txt", "logfile.log", "listfile.lst", "machineCode.o", "machineCode.cache", pool, true);
+       job.assemble();
+       return 0;
+   }
+
+   // Batch: the pool runs whole files, each on one thread; results are reported in the order given
+   auto start = chrono::steady_clock::now();
+   vector<string> summary(sources.size());
+   vector<char> failed(sources.size(), 0);
+   pool.run(sources.size(), [&](int f) {
+       // Outputs are named after the source with its extension replaced
+       string base = sources[f];
+       size_t dot = base.find_last_of('.');
+       if (dot != string::npos && dot > base.find_last_of('/') + 1) base.erase(dot);
+       ThreadPool serial(1);
+       Assembler job(sources[f], base + ".log", base + ".lst", base + ".o", base + ".cache", serial, false);
+       try {
+           failed[f] = !job.assemble();
+       } catch (const exception &error) {
+           // A file the checks let through by mistake fails on its own instead of ending the whole batch
+           failed[f] = true;
+           summary[f] = sources[f] + ": internal error (" + error.what() + ")";
+           return;
+       }
+       if (job.inputMissing) {
+           summary[f] = sources[f] + ": input file doesn't exist";
+       } else if (failed[f]) {
+           summary[f] = sources[f] + ": " + to_string(job.errorList.size()) + " error(s), see " + base + ".log";
+       } else {
+           summary[f] = sources[f] + ": " + to_string(job.programSize) + " word(s), " + to_string(job.warningList.size()) + " warning(s)";
+           if (optimizeMode) summary[f] += ", " + job.optimizerSummary;
+       }
+   });
+   int failures = count(failed.begin(), failed.end(), 1);
+   for (const auto &line : summary) cout << line << endl;
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+   printf("%d file(s) assembled, %d failed, %.3f s, %d thread(s)\n", (int)sources.size() - failures, failures, seconds, pool.size());
+   return failures ? 1 : 0;
 }
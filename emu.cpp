@@ -1,13 +1,57 @@
 #include<bits/stdc++.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
 using namespace std;
 
-vector<int> objectFile;
-vector<int> memory(1<<24);
-int PC=0;
-int SP=0;
-int regA=0;
-int regB=0;
-int total=0;
+// Guest memory: 2^24 words reserved with one anonymous mapping instead of a zero-filled vector.
+// The OS supplies zero pages on first touch, so startup does not clear 64 MiB and untouched
+// memory takes no RSS; bounds checks still compare against size()
+struct GuestMemory {
+    static const size_t WORDS = 1 << 24;
+    int* words = nullptr;
+
+    GuestMemory() {
+        void* mapped = mmap(nullptr, WORDS * sizeof(int), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapped == MAP_FAILED) {
+            // No reservation possible: calloc still gets lazily zeroed pages for a block this large
+            mapped = calloc(WORDS, sizeof(int));
+            isMapped = false;
+            if (mapped == nullptr) {
+                cerr << "Cannot allocate guest memory" << endl;
+                exit(1);
+            }
+        }
+        words = static_cast<int*>(mapped);
+    }
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+    ~GuestMemory() {
+        if (isMapped) munmap(words, WORDS * sizeof(int));
+        else free(words);
+    }
+    size_t size() const { return WORDS; }
+    int* data() { return words; }
+    int& operator[](size_t index) { return words[index]; }
+    // Zero everything again; mapped pages are handed back to the OS rather than overwritten.
+    // A fresh anonymous mapping also drops pages a snapshot mapped in from its file
+    void clear() {
+        if (!isMapped || mmap(words, WORDS * sizeof(int), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            memset(words, 0, WORDS * sizeof(int));
+        }
+    }
+    // Map bytes of a file copy-on-write over guest memory starting at firstWord; both offsets must be page aligned
+    bool mapFile(int fd, off_t offset, size_t firstWord, size_t bytes) {
+        return isMapped && mmap(words + firstWord, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                                fd, offset) != MAP_FAILED;
+    }
+
+private:
+    bool isMapped = true;
+};
 int stackLimit=1<<23;
 
 vector<string> mnemonics{"ldc",
@@ -52,174 +96,1890 @@ enum Opcode {
     HALT=18 // Default case for invalid opcodes
 };
 
-void executeOpcode(int opcode, int operand) {
+// Pre-decoded form of one machine word, built once at load time
+struct DecodedInstr {
+    const void* handler;  // Dispatch target used by the threaded loop (filled in lazily)
+    int kind;             // Handler index: the opcode for valid words, HANDLER_INVALID or HANDLER_END otherwise
+    int opcode;           // Raw opcode (last 8 bits of the word)
+    int operand;          // Sign-extended operand (first 24 bits of the word)
+};
+
+// Extra handler indices beyond the 19 real opcodes
+const int HANDLER_INVALID = 19;  // Word whose opcode is not part of the instruction set
+const int HANDLER_END = 20;      // Sentinel placed just past the last word of the program
+// Patched in by the debugger (see Debugger); only the threaded engine runs them
+const int HANDLER_TRAP = 21;     // Breakpoint on this word
+const int HANDLER_STL_WATCH = 22;   // stl while watchpoints are set
+const int HANDLER_STNL_WATCH = 23;  // stnl while watchpoints are set
+const int HANDLER_COUNT = 24;
+
+// Why a run stopped. The engines return it instead of exiting, so one failing machine does not end the process
+enum ExitReason {
+    EXIT_NONE = 0,        // Still running
+    EXIT_HALT,
+    EXIT_SEGFAULT,        // PC left the program
+    EXIT_OVERFLOW,        // SP went past stackLimit
+    EXIT_BAD_SP_ACCESS,   // ldl/stl outside memory
+    EXIT_BAD_A_ACCESS,    // ldnl/stnl outside memory
+    EXIT_INVALID_OPCODE,
+    EXIT_BREAKPOINT,      // Reached a breakpoint (the instruction there has not run)
+    EXIT_WATCHPOINT,      // A store wrote to a watched address
+    EXIT_COUNT,           // Ran the number of instructions it was asked to
+    EXIT_BUDGET,          // Used up its instruction budget (see RunLimits)
+    EXIT_DEADLINE         // Ran past its wall-clock deadline
+};
+const char* const exitNames[] = {"running", "halt", "segfault", "stack_overflow", "bad_sp_access", "bad_a_access",
+                                 "invalid_opcode", "breakpoint", "watchpoint", "count", "budget", "deadline"};
+
+// Breakpoints and watchpoints of the interactive prompt. A breakpoint turns the record of its PC in
+// decodedProgram into a trap, and while watchpoints are set the stl/stnl records get handlers that look
+// up a per-page flag after the store. With neither set nothing is patched, so runs pay nothing for them
+struct Debugger {
+    static const int PAGE_SHIFT = 10;
+    struct Breakpoint {
+        char reg = 0;         // 'A', 'B' or 'S' (SP) for a conditional breakpoint, 0 to always stop
+        string op;            // ==, !=, <, <=, > or >=
+        int value = 0;
+        bool temporary = false;  // Placed by -until and removed once the run stops
+    };
+    map<int, Breakpoint> breakpoints;
+    vector<pair<int, int>> watchpoints;  // Watched address ranges, both ends included
+    vector<char> watchedPages;           // Pages overlapping a watchpoint
+    int hitAddress = 0, hitOld = 0;      // Store that hit a watchpoint
+
+    // Called by the trap at pc: true if the breakpoint there stops the run with these registers
+    bool stopAt(int pc, int a, int b, int sp) const {
+        auto found = breakpoints.find(pc);
+        if (found == breakpoints.end()) return false;
+        const Breakpoint &bp = found->second;
+        if (bp.reg == 0) return true;
+        int lhs = (bp.reg == 'A') ? a : (bp.reg == 'B') ? b : sp;
+        if (bp.op == "==") return lhs == bp.value;
+        if (bp.op == "!=") return lhs != bp.value;
+        if (bp.op == "<") return lhs < bp.value;
+        if (bp.op == "<=") return lhs <= bp.value;
+        if (bp.op == ">") return lhs > bp.value;
+        return lhs >= bp.value;
+    }
+    // Called after a store to a watched page: true (and the store recorded) if addr is watched
+    bool watchHit(int addr, int old) {
+        for (const auto &range : watchpoints) {
+            if (addr >= range.first && addr <= range.second) {
+                hitAddress = addr;
+                hitOld = old;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// One emulated machine: guest memory, the loaded program and the registers.
+// Engines take the machine they run, so any number of them can run side by side.
+// Instructions are fetched from memory: the program occupies words [0, objectFile.size()) and
+// decodedProgram caches those words decoded. Every store into that range decodes the word again
+// (see store()), so programs may modify their own code
+struct Machine {
+    GuestMemory memory;
+    vector<int> objectFile;               // The program as loaded; only used to reset and save the machine
+    vector<DecodedInstr> decodedProgram;  // Code words of memory as {handler, operand} records, plus the end sentinel
+    const void* const* handlers = nullptr;  // Handler table the records are bound to (nullptr: not bound)
+    int PC = 0;
+    int SP = 0;
+    int regA = 0;
+    int regB = 0;
+    long long total = 0;  // Instructions executed so far
+    // runBlocks() and runJit() return EXIT_COUNT at the first block boundary once total has reached this
+    long long limit = LLONG_MAX;
+    Debugger debug;
+
+    // Take the program, put it at address 0 and decode it
+    void load(vector<int> words) {
+        objectFile = move(words);
+        memcpy(memory.data(), objectFile.data(), objectFile.size() * sizeof(int));
+        decodeProgram();
+    }
+    int codeSize() const { return objectFile.size(); }
+    // Decode every code word of memory once so the run loops never mask and shift again
+    void decodeProgram() {
+        decodedProgram.clear();
+        decodedProgram.reserve(codeSize() + 1);
+        for (int pc = 0; pc < codeSize(); ++pc) decodedProgram.push_back(decode(memory[pc]));
+        // Running off the end of the program lands on this record instead of needing a bounds check per step
+        decodedProgram.push_back({nullptr, HANDLER_END, 0, 0});
+        handlers = nullptr;
+        if (!debug.breakpoints.empty() || !debug.watchpoints.empty()) {
+            for (int pc = 0; pc < codeSize(); ++pc) decodedProgram[pc].kind = debugKind(pc);
+        }
+    }
+    static DecodedInstr decode(int word) {
+        int opcode = word & 0xFF;  // Last 8 bits (opcode)
+        int kind = (opcode <= HALT) ? opcode : HANDLER_INVALID;
+        return {nullptr, kind, opcode, word >> 8};
+    }
+    // Kind the record at pc runs as: its instruction's, a trap, or a watched store
+    int debugKind(int pc) const {
+        return debug.breakpoints.count(pc) ? HANDLER_TRAP : watchedKind(decodedProgram[pc].opcode);
+    }
+    // Kind an instruction with this opcode runs as when no breakpoint is on it
+    int watchedKind(int opcode) const {
+        if (opcode > HALT) return HANDLER_INVALID;
+        if (debug.watchpoints.empty()) return opcode;
+        return (opcode == stl) ? HANDLER_STL_WATCH : (opcode == stnl) ? HANDLER_STNL_WATCH : opcode;
+    }
+    // A store hit the code word at addr: decode it again so the next fetch sees the new instruction
+    void codeWritten(int addr) {
+        decodedProgram[addr] = decode(memory[addr]);
+        if (!debug.breakpoints.empty() || !debug.watchpoints.empty()) decodedProgram[addr].kind = debugKind(addr);
+        if (handlers) decodedProgram[addr].handler = handlers[decodedProgram[addr].kind];
+    }
+    // Repatch the record at pc after a breakpoint there was set or cleared
+    void rebind(int pc) {
+        decodedProgram[pc].kind = debugKind(pc);
+        if (handlers) decodedProgram[pc].handler = handlers[decodedProgram[pc].kind];
+    }
+    void setBreakpoint(int pc, const Debugger::Breakpoint &bp) {
+        debug.breakpoints[pc] = bp;
+        if ((unsigned)pc < (unsigned)codeSize()) rebind(pc);
+    }
+    void clearBreakpoint(int pc) {
+        debug.breakpoints.erase(pc);
+        if ((unsigned)pc < (unsigned)codeSize()) rebind(pc);
+    }
+    // Watch stores to [first, last]; the first watchpoint switches the stores over to the watching handlers
+    void addWatchpoint(int first, int last) {
+        debug.watchpoints.push_back({first, last});
+        debug.watchedPages.resize(memory.size() >> Debugger::PAGE_SHIFT, 0);
+        for (int page = first >> Debugger::PAGE_SHIFT; page <= last >> Debugger::PAGE_SHIFT; ++page) {
+            debug.watchedPages[page] = 1;
+        }
+        for (int pc = 0; pc < codeSize(); ++pc) rebind(pc);
+    }
+    // Remove every breakpoint and watchpoint
+    void clearDebug() {
+        debug = Debugger();
+        for (int pc = 0; pc < codeSize(); ++pc) rebind(pc);
+    }
+    // Store to memory; addr must be in bounds
+    void store(int addr, int value) {
+        memory[addr] = value;
+        if ((unsigned)addr < (unsigned)codeSize()) codeWritten(addr);
+    }
+    // Put the machine back into its power-on state with the program loaded at address 0
+    void reset() {
+        memory.clear();
+        copy(objectFile.begin(), objectFile.end(), memory.data());
+        decodeProgram();
+        PC = SP = regA = regB = total = 0;
+    }
+};
+
+// Print the message for a run that aborted and leave with the status the emulator has always used
+void exitOnError(ExitReason reason) {
+    switch (reason) {
+        case EXIT_SEGFAULT:
+            cout << "Segmentation fault. Aborting.\n";
+            exit(0);
+        case EXIT_OVERFLOW:
+            cout << "Stack overflow. Aborting.\n";
+            exit(0);
+        case EXIT_BAD_SP_ACCESS:
+            cout << "Memory access error at SP + operand. Aborting.";
+            exit(1);
+        case EXIT_BAD_A_ACCESS:
+            cout << "Memory access error at regA + operand. Aborting.";
+            exit(1);
+        case EXIT_INVALID_OPCODE:
+            cout << "Invalid opcode. Incorrect machine code. Aborting." << endl;
+            exit(1);
+        default:
+            break;
+    }
+}
+
+// Execute one instruction on the machine; returns EXIT_NONE, or why it could not be executed
+ExitReason executeOpcode(Machine &m, int opcode, int operand) {
     switch(opcode) {
         case ldc: 
             // Load operand into regA and save old value of regA in regB
-            regB = regA;
-            regA = operand;
+            m.regB = m.regA;
+            m.regA = operand;
             break;
         
         case adc: 
             // Add operand to regA
-            regA += operand;
+            m.regA += operand;
             break;
         
         case ldl: 
             // Load value from mainMemory[SP + operand] into regA and save old value of regA in regB
-            regB = regA;
-            if (SP + operand >= 0 && SP + operand < memory.size()) {
-                regA = memory[SP + operand];
+            m.regB = m.regA;
+            if (m.SP + operand >= 0 && m.SP + operand < m.memory.size()) {
+                m.regA = m.memory[m.SP + operand];
             } else {
-                cout << "Memory access error at SP + operand. Aborting.";
-                exit(1);  // Handle out-of-bounds memory access error
+                return EXIT_BAD_SP_ACCESS;  // Out-of-bounds memory access
             }
             break;
         
         case stl: 
             // Store value from regA to mainMemory[SP + operand] and restore regA to regB
-            if (SP + operand >= 0 && SP + operand < memory.size()) {
-                memory[SP + operand] = regA;
+            if (m.SP + operand >= 0 && m.SP + operand < m.memory.size()) {
+                m.store(m.SP + operand, m.regA);
             } else {
-                cout << "Memory access error at SP + operand. Aborting.";
-                exit(1);  // Handle out-of-bounds memory access error
+                return EXIT_BAD_SP_ACCESS;  // Out-of-bounds memory access
             }
-            regA = regB;
+            m.regA = m.regB;
             break;
         
         case ldnl: 
             // Load value from mainMemory[regA + operand] into regA
-            if (regA + operand >= 0 && regA + operand < memory.size()) {
-                regA = memory[regA + operand];
+            if (m.regA + operand >= 0 && m.regA + operand < m.memory.size()) {
+                m.regA = m.memory[m.regA + operand];
             } else {
-                cout << "Memory access error at regA + operand. Aborting.";
-                exit(1);  // Handle out-of-bounds memory access error
+                return EXIT_BAD_A_ACCESS;  // Out-of-bounds memory access
             }
             break;
         
         case stnl: 
             // Store value from regB to mainMemory[regA + operand]
-            if (regA + operand >= 0 && regA + operand < memory.size()) {
-                memory[regA + operand] = regB;
+            if (m.regA + operand >= 0 && m.regA + operand < m.memory.size()) {
+                m.store(m.regA + operand, m.regB);
             } else {
-                cout << "Memory access error at regA + operand. Aborting.";
-                exit(1);  // Handle out-of-bounds memory access error
+                return EXIT_BAD_A_ACCESS;  // Out-of-bounds memory access
             }
             break;
         
         case add: 
             // Add regA and regB and store the result in regA
-            regA = regB + regA;
+            m.regA = m.regB + m.regA;
             break;
         
         case sub: 
             // Subtract regA from regB and store the result in regA
-            regA = regB - regA;
+            m.regA = m.regB - m.regA;
             break;
         
         case shl: 
             // Shift regB left by regA positions
-            regA = regB << regA;
+            m.regA = m.regB << m.regA;
             break;
         
         case shr: 
             // Shift regB right by regA positions
-            regA = regB >> regA;
+            m.regA = m.regB >> m.regA;
             break;
         
         case adj: 
             // Add operand to SP (Stack Pointer)
-            SP = SP + operand;
+            m.SP = m.SP + operand;
             break;
         
         case a2sp: 
             // Move value from SP to regA and regB to regA
-            SP = regA;
-            regA = regB;
+            m.SP = m.regA;
+            m.regA = m.regB;
             break;
         
         case sp2a: 
             // Move value from SP to regA and regB to regA
-            regB = regA;
-            regA = SP;
+            m.regB = m.regA;
+            m.regA = m.SP;
             break;
         
         case call: 
             // Save PC to regA and load operand-1 to PC
-            regB = regA;
-            regA = PC;
-            PC = operand - 1;
+            m.regB = m.regA;
+            m.regA = m.PC;
+            m.PC = operand - 1;
             break;
         
         case ret: 
             // Save regA to PC and regB to regA
-            PC = regA;
-            regA = regB;
+            m.PC = m.regA;
+            m.regA = m.regB;
             break;
         
         case brz: 
             // Conditional jump: if regA is 0, update PC with operand
-            if (regA == 0) {
-                PC = PC + operand;
+            if (m.regA == 0) {
+                m.PC = m.PC + operand;
             }
             break;
         
         case brlz: 
             // Conditional jump: if regA is negative, update PC with operand
-            if (regA < 0) {
-                PC = PC + operand;
+            if (m.regA < 0) {
+                m.PC = m.PC + operand;
             }
             break;
         
         case br: 
             // Unconditional jump: update PC with operand
-            PC = PC + operand;
+            m.PC = m.PC + operand;
             break;
         
         default: 
             // Handle invalid opcode
-            cout << "Invalid opcode. Incorrect machine code. Aborting." << endl;
-            exit(1);  // Exit program with error code
+            return EXIT_INVALID_OPCODE;
     }    
+    return EXIT_NONE;
 }
 
-int argumentrun() {
-    // Check if PC is within the bounds of objectFile size
-    if (PC >= objectFile.size()) {
-        cout << "Segmentation fault. Aborting.\n";
-        exit(0);  // Exit if the PC exceeds the objectFile size
+int argumentrun(Machine &m) {
+    // Check if PC is within the bounds of the program
+    if ((unsigned)m.PC >= (unsigned)m.codeSize()) {
+        exitOnError(EXIT_SEGFAULT);  // Exit if the PC runs past the program
     }
 
-    // Extract opcode and operand
-    int opcode = objectFile[PC] & 0xFF;      // Last 8 bits (opcode)
-    int operand = objectFile[PC] >> 8;       // First 24 bits (operand)
+    // Fetch the pre-decoded opcode and operand
+    int opcode = m.decodedProgram[m.PC].opcode;
+    int operand = m.decodedProgram[m.PC].operand;
 
     // Print the mnemonic and operand in a formatted way
-    cout << mnemonics[opcode] << "\t";
+    cout << (opcode < (int)mnemonics.size() ? mnemonics[opcode] : "") << "\t";
     printf("%08X\n", operand);
 
     // Handle HALT condition (opcode 18)
     if (opcode == 18) {
-        total++;
+        m.total++;
         return 0;  // HALT, exit the function and return to the main function
     }
 
     // Execute the corresponding opcode with its operand
-    executeOpcode(opcode, operand);
+    exitOnError(executeOpcode(m, opcode, operand));
 
     // Increment total instructions executed and PC
-    total++;
-    PC++;
+    m.total++;
+    m.PC++;
 
     // Stack overflow check
-    if (SP > stackLimit) {
-        cout << "Stack overflow. Aborting.\n";
-        exit(0);  // Exit if stack pointer exceeds the stack limit
+    if (m.SP > stackLimit) {
+        exitOnError(EXIT_OVERFLOW);  // Exit if stack pointer exceeds the stack limit
     }
 
     return 1;  // Return to indicate successful execution
 }
 
+// Run to HALT the way argumentrun() does, decoding memory[PC] on every step, but without printing
+// Kept as the reference point for --bench
+ExitReason runSwitch(Machine &m) {
+    while (true) {
+        if ((unsigned)m.PC >= (unsigned)m.codeSize()) return EXIT_SEGFAULT;
+        int opcode = m.memory[m.PC] & 0xFF;
+        int operand = m.memory[m.PC] >> 8;
+        if (opcode == HALT) {
+            m.total++;
+            return EXIT_HALT;
+        }
+        ExitReason reason = executeOpcode(m, opcode, operand);
+        if (reason != EXIT_NONE) return reason;
+        m.total++;
+        m.PC++;
+        if (m.SP > stackLimit) return EXIT_OVERFLOW;
+    }
+}
+
+// Binary execution trace ("--trace"): one fixed-size record per instruction instead of two printf lines.
+// Records are collected in chunks that a background thread writes out, or kept in a ring of the last
+// N records (--ring N) that is written once at exit. "--decode-trace" renders a trace as -all would
+struct TraceRecord {
+    int pc;        // Address of the instruction
+    int opcode;    // Raw opcode
+    int operand;   // Sign-extended operand
+    int a, b, sp;  // Registers after the instruction ran
+    int nextPc;    // PC after the instruction ran
+};
+
+// Start of a trace file, followed by the records
+struct TraceHeader {
+    char magic[8];        // "EMUTRACE"
+    uint32_t recordSize;  // sizeof(TraceRecord)
+    uint32_t reserved;
+    uint64_t firstIndex;  // Instruction number of the first record (non-zero when a ring dropped older ones)
+};
+
+class TraceWriter {
+public:
+    static const size_t CHUNK = 1 << 16;  // Records handed to the writer thread at a time
+
+    // Open the output; ringSize 0 streams every record to the file, otherwise only the last ringSize are kept
+    bool open(const string &path, size_t ringSize) {
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) return false;
+        ring = ringSize != 0;
+        buffer.resize(ring ? ringSize : CHUNK);
+        if (!ring) {
+            writeHeader(0);
+            spare.resize(CHUNK);
+            writer = thread([this] { writeLoop(); });
+        }
+        return true;
+    }
+    void append(const TraceRecord &record) {
+        buffer[used++] = record;
+        if (used == buffer.size()) full();
+    }
+    // Write whatever is still buffered and close the file (safe to call more than once)
+    void close() {
+        if (file == nullptr) return;
+        if (ring) {
+            // Oldest records first: after a wrap they start at the current position
+            size_t kept = min<size_t>(appended + used, buffer.size());
+            writeHeader(appended + used - kept);
+            if (appended > 0) fwrite(buffer.data() + used, sizeof(TraceRecord), buffer.size() - used, file);
+            fwrite(buffer.data(), sizeof(TraceRecord), used, file);
+        } else {
+            {
+                unique_lock<mutex> lock(guard);
+                idle.wait(lock, [this] { return pendingCount == 0; });
+                stopping = true;
+            }
+            ready.notify_one();
+            writer.join();
+            fwrite(buffer.data(), sizeof(TraceRecord), used, file);
+        }
+        fclose(file);
+        file = nullptr;
+    }
+
+private:
+    FILE* file = nullptr;
+    bool ring = false;
+    vector<TraceRecord> buffer;   // Records being filled
+    size_t used = 0;
+    uint64_t appended = 0;        // Records already handed over (file) or overwritten laps (ring)
+    // Writer thread state: the engine fills one chunk while the thread writes the other
+    vector<TraceRecord> spare;
+    size_t pendingCount = 0;
+    bool stopping = false;
+    mutex guard;
+    condition_variable ready, idle;
+    thread writer;
+
+    void writeHeader(uint64_t firstIndex) {
+        TraceHeader header = {{'E', 'M', 'U', 'T', 'R', 'A', 'C', 'E'}, sizeof(TraceRecord), 0, firstIndex};
+        fwrite(&header, sizeof(header), 1, file);
+    }
+    void full() {
+        appended += used;
+        used = 0;
+        if (ring) return;
+        unique_lock<mutex> lock(guard);
+        idle.wait(lock, [this] { return pendingCount == 0; });
+        buffer.swap(spare);
+        pendingCount = CHUNK;
+        lock.unlock();
+        ready.notify_one();
+    }
+    void writeLoop() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            ready.wait(lock, [this] { return pendingCount != 0 || stopping; });
+            if (pendingCount == 0) return;
+            lock.unlock();
+            fwrite(spare.data(), sizeof(TraceRecord), pendingCount, file);
+            lock.lock();
+            pendingCount = 0;
+            idle.notify_one();
+        }
+    }
+};
+TraceWriter traceWriter;
+
+// Run to HALT like runSwitch(), appending a trace record for every instruction that completes
+ExitReason runTraced(Machine &m) {
+    const DecodedInstr* code = m.decodedProgram.data();
+    while (true) {
+        if ((unsigned)m.PC >= (unsigned)m.codeSize()) return EXIT_SEGFAULT;
+        int pc = m.PC;
+        int opcode = code[pc].opcode;
+        int operand = code[pc].operand;
+        if (opcode == HALT) {
+            m.total++;
+            traceWriter.append({pc, opcode, operand, m.regA, m.regB, m.SP, pc});
+            return EXIT_HALT;
+        }
+        ExitReason reason = executeOpcode(m, opcode, operand);
+        if (reason != EXIT_NONE) return reason;
+        m.total++;
+        m.PC++;
+        traceWriter.append({pc, opcode, operand, m.regA, m.regB, m.SP, m.PC});
+        if (m.SP > stackLimit) return EXIT_OVERFLOW;
+    }
+}
+
+// Print the records of a trace file in the -all text format, keeping those whose PC lies in [pcFrom, pcTo]
+// and whose instruction number lies in [from, to)
+int decodeTrace(const string &path, long long pcFrom, long long pcTo, unsigned long long from, unsigned long long to) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TraceHeader)) {
+        std::cerr << "Error opening trace: " << path << std::endl;
+        if (fd >= 0) ::close(fd);
+        return 1;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error mapping trace: " << path << std::endl;
+        return 1;
+    }
+    const TraceHeader* header = static_cast<const TraceHeader*>(mapped);
+    if (memcmp(header->magic, "EMUTRACE", 8) != 0 || header->recordSize != sizeof(TraceRecord)) {
+        std::cerr << "Not a trace file: " << path << std::endl;
+        munmap(mapped, info.st_size);
+        return 1;
+    }
+    const TraceRecord* records = reinterpret_cast<const TraceRecord*>(header + 1);
+    size_t count = (info.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    // Format into one buffer and write it in large pieces
+    string text;
+    char line[96];
+    for (size_t i = 0; i < count; ++i) {
+        unsigned long long index = header->firstIndex + i;
+        if (index < from) continue;
+        if (index >= to) break;
+        const TraceRecord &record = records[i];
+        if (record.pc < pcFrom || record.pc > pcTo) continue;
+        text += (record.opcode < (int)mnemonics.size()) ? mnemonics[record.opcode] : "";
+        snprintf(line, sizeof(line), "\t%08X\n", record.operand);
+        text += line;
+        if (record.opcode != HALT) {
+            snprintf(line, sizeof(line), "A = %08X, B = %08X, PC = %08X, SP = %08X\n", record.a, record.b,
+                     record.nextPc, record.sp);
+            text += line;
+        }
+        if (text.size() >= (1 << 20)) {
+            fwrite(text.data(), 1, text.size(), stdout);
+            text.clear();
+        }
+    }
+    fwrite(text.data(), 1, text.size(), stdout);
+    munmap(mapped, info.st_size);
+    return 0;
+}
+
+// Computed goto is a GCC/Clang extension; other compilers (or -DEMU_NO_COMPUTED_GOTO) get the switch based loop
+#if defined(__GNUC__) && !defined(EMU_NO_COMPUTED_GOTO)
+#define EMU_COMPUTED_GOTO 1
+#endif
+
+// Guest profiler for "--profile": flat counters indexed by PC, filled in by runThreadedImpl<true>(), and a
+// shadow call stack that is only touched on call/ret. The report is written from an atexit handler, so runs
+// that abort (segmentation fault, bad memory access, ...) are reported as well
+class Profiler {
+public:
+    vector<long long> hits;    // Executions of the word at each PC (the last slot is the end sentinel)
+    vector<long long> taken;   // Taken brz/brlz at each PC
+    string listingPath;        // Listing used to map PCs back to source statements
+    string foldedPath;         // Folded-stacks output for flamegraph.pl (empty for none)
+
+    // Start profiling the program loaded into m, from its current PC
+    void reset(const Machine &m) {
+        machine = &m;
+        hits.assign(m.codeSize() + 1, 0);
+        taken.assign(m.codeSize() + 1, 0);
+        nodes.assign(1, {-1, m.PC, 0});
+        children.clear();
+        current = 0;
+        marked = 0;
+    }
+    // Called by the engine on call (executedSoFar includes the call itself): count what ran in the caller
+    void enter(int target, long long executedSoFar) {
+        nodes[current].self += executedSoFar - marked;
+        marked = executedSoFar;
+        auto found = children.find({current, target});
+        if (found == children.end()) {
+            nodes.push_back({current, target, 0});
+            found = children.insert({{current, target}, (int)nodes.size() - 1}).first;
+        }
+        current = found->second;
+    }
+    // Called by the engine on ret; a ret without a matching call stays in the outermost frame
+    void leave(long long executedSoFar) {
+        nodes[current].self += executedSoFar - marked;
+        marked = executedSoFar;
+        if (nodes[current].parent != -1) current = nodes[current].parent;
+    }
+    void report() {
+        long long executed = 0;
+        for (size_t i = 0; i + 1 < hits.size(); ++i) executed += hits[i];
+        nodes[current].self += executed - marked;
+        marked = executed;
+        readListing();
+
+        int codeSize = hits.size() - 1;
+        vector<int> order;
+        for (int pc = 0; pc < codeSize; ++pc) {
+            if (hits[pc] > 0) order.push_back(pc);
+        }
+        stable_sort(order.begin(), order.end(), [this](int x, int y) { return hits[x] > hits[y]; });
+        printf("\nProfile: %lld instructions\n", executed);
+        printf("\nHot PCs:\n");
+        printf("      PC        count       %%  statement\n");
+        for (int i = 0; i < (int)order.size() && i < TOP; ++i) {
+            int pc = order[i];
+            printf("%08X %12lld %6.2f%%  %s\n", pc, hits[pc], 100.0 * hits[pc] / executed, statement(pc).c_str());
+        }
+
+        // A taken backward branch closes a loop running from its target to the branch
+        printf("\nHot loops:\n");
+        printf("   start      end   iterations  instructions       %%\n");
+        vector<pair<long long, pair<int, int>>> loops;  // Instructions inside, {start, end}
+        for (int pc = 0; pc < codeSize; ++pc) {
+            int kind = machine->decodedProgram[pc].kind;
+            if (kind != brz && kind != brlz && kind != br) continue;
+            int target = pc + 1 + machine->decodedProgram[pc].operand;
+            long long iterations = (kind == br) ? hits[pc] : taken[pc];
+            if (target > pc || target < 0 || iterations == 0) continue;
+            long long inside = 0;
+            for (int i = target; i <= pc; ++i) inside += hits[i];
+            loops.push_back({inside, {target, pc}});
+        }
+        stable_sort(loops.begin(), loops.end(), [](const auto &x, const auto &y) { return x.first > y.first; });
+        for (int i = 0; i < (int)loops.size() && i < TOP; ++i) {
+            int start = loops[i].second.first, end = loops[i].second.second;
+            long long iterations = (machine->decodedProgram[end].kind == br) ? hits[end] : taken[end];
+            printf("%08X %08X %12lld %13lld %6.2f%%  %s\n", start, end, iterations, loops[i].first,
+                   100.0 * loops[i].first / executed, statement(start).c_str());
+        }
+
+        printf("\nBranches:\n");
+        printf("      PC     executed        taken    not taken  statement\n");
+        for (int pc = 0; pc < codeSize; ++pc) {
+            int kind = machine->decodedProgram[pc].kind;
+            if ((kind != brz && kind != brlz) || hits[pc] == 0) continue;
+            printf("%08X %12lld %12lld %12lld  %s\n", pc, hits[pc], taken[pc], hits[pc] - taken[pc],
+                   statement(pc).c_str());
+        }
+
+        printf("\nCalls and returns:\n");
+        printf("      PC        count   target  statement\n");
+        for (int pc = 0; pc < codeSize; ++pc) {
+            int kind = machine->decodedProgram[pc].kind;
+            if ((kind != call && kind != ret) || hits[pc] == 0) continue;
+            if (kind == call) {
+                printf("%08X %12lld %08X  %s\n", pc, hits[pc], machine->decodedProgram[pc].operand, statement(pc).c_str());
+            } else {
+                printf("%08X %12lld %8s  %s\n", pc, hits[pc], "", statement(pc).c_str());
+            }
+        }
+
+        if (!foldedPath.empty()) writeFolded();
+    }
+
+private:
+    static const int TOP = 20;  // Rows in the hot PC and hot loop tables
+    const Machine* machine = nullptr;
+    struct StackNode {
+        int parent;       // Caller's node (-1 for the outermost frame)
+        int function;     // Entry PC of the frame
+        long long self;   // Instructions executed in this frame itself
+    };
+    vector<StackNode> nodes;
+    map<pair<int, int>, int> children;  // {node, call target} -> node of the callee
+    int current = 0;
+    long long marked = 0;               // Instructions already charged to a frame
+    map<int, string> statements;        // PC -> source statement from the listing
+    map<int, string> labels;            // PC -> label defined there
+
+    // Load "PPPPPPPP WWWWWWWW statement" lines (or "PPPPPPPP          label:" for lines without code)
+    void readListing() {
+        ifstream listing(listingPath);
+        string line;
+        while (getline(listing, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.size() < 18) continue;
+            int pc = strtol(line.substr(0, 8).c_str(), nullptr, 16);
+            string text = line.substr(18);
+            while (!text.empty() && text.back() == ' ') text.pop_back();
+            size_t colon = text.find(':');
+            if (colon != string::npos && !labels.count(pc)) labels[pc] = text.substr(0, colon);
+            if (line[9] != ' ' && !statements.count(pc)) statements[pc] = text;
+        }
+    }
+    string statement(int pc) {
+        auto found = statements.find(pc);
+        if (found != statements.end()) return found->second;
+        int kind = machine->decodedProgram[pc].kind;
+        return kind < HANDLER_INVALID ? mnemonics[kind] : "(invalid)";
+    }
+    string frameName(int pc) {
+        auto found = labels.find(pc);
+        if (found != labels.end()) return found->second;
+        char name[16];
+        snprintf(name, sizeof(name), "%08X", pc);
+        return name;
+    }
+    // One "outer;...;inner count" line per stack with instructions of its own
+    void writeFolded() {
+        ofstream out(foldedPath);
+        for (int i = 0; i < (int)nodes.size(); ++i) {
+            if (nodes[i].self == 0) continue;
+            vector<string> frames;
+            for (int node = i; node != -1; node = nodes[node].parent) frames.push_back(frameName(nodes[node].function));
+            for (int j = frames.size() - 1; j >= 0; --j) out << frames[j] << (j ? ";" : " ");
+            out << nodes[i].self << "\n";
+        }
+        printf("\nFolded stacks written to %s\n", foldedPath.c_str());
+    }
+};
+Profiler profiler;
+
+// Run to HALT over decodedProgram with direct-threaded dispatch and no per-step output
+// Registers live in locals for the whole run and are written back when it stops.
+// With PROFILE the profiler's counters are updated as well (see runProfiled()), and with COUNTED the
+// run also stops after limit instructions (see runCounted())
+template <bool PROFILE, bool COUNTED = false>
+ExitReason runThreadedImpl(Machine &m, long long limit = 0) {
+    int pc = m.PC, sp = m.SP, a = m.regA, b = m.regB;
+    long long executed = 0;
+    int codeSize = m.codeSize();
+    int memSize = m.memory.size();
+    int* mem = m.memory.data();
+    DecodedInstr* code = m.decodedProgram.data();
+    long long* hits = PROFILE ? profiler.hits.data() : nullptr;
+    long long* taken = PROFILE ? profiler.taken.data() : nullptr;
+    ExitReason reason;
+
+#ifdef EMU_COMPUTED_GOTO
+    static const void* const labels[HANDLER_COUNT] = {
+        &&h_ldc, &&h_adc, &&h_ldl, &&h_stl, &&h_ldnl, &&h_stnl, &&h_add, &&h_sub, &&h_shl, &&h_shr,
+        &&h_adj, &&h_a2sp, &&h_sp2a, &&h_call, &&h_ret, &&h_brz, &&h_brlz, &&h_br, &&h_HALT,
+        &&h_invalid, &&h_end, &&h_trap, &&h_stl_watch, &&h_stnl_watch};
+    // Bind each record to this engine's handler addresses
+    if (m.handlers != labels) {
+        for (int i = 0; i <= codeSize; ++i) code[i].handler = labels[code[i].kind];
+        m.handlers = labels;
+    }
+#define HANDLER(name) h_##name:
+#define DISPATCH() do { \
+        if (COUNTED && executed >= limit) STOP(EXIT_COUNT); \
+        if (PROFILE) ++hits[pc]; \
+        goto *code[pc].handler; \
+    } while (0)
+// Run the record at pc as the handler of another kind
+#define REDISPATCH(k) goto *labels[k]
+#else
+#define HANDLER(name) case h_##name:
+#define DISPATCH() { if (PROFILE) ++hits[pc]; continue; }
+#define REDISPATCH(k) { kind = k; goto redispatch; }
+    enum { h_ldc, h_adc, h_ldl, h_stl, h_ldnl, h_stnl, h_add, h_sub, h_shl, h_shr, h_adj, h_a2sp,
+           h_sp2a, h_call, h_ret, h_brz, h_brlz, h_br, h_HALT, h_invalid, h_end, h_trap, h_stl_watch,
+           h_stnl_watch };
+    int kind;
+#endif
+
+#define STOP(why) { reason = why; goto stop; }
+// Only jumps can leave the program, so the PC check lives here instead of in every handler
+#define CHECK_PC() if ((unsigned)pc >= (unsigned)codeSize) STOP(EXIT_SEGFAULT)
+// Only adj and a2sp move SP, so the stack limit is checked there alone
+#define CHECK_SP() if (sp > stackLimit) STOP(EXIT_OVERFLOW)
+#define CHECK_ADDR(addr, why) if ((unsigned)(addr) >= (unsigned)memSize) STOP(why)
+// The program sits at the bottom of memory, so one compare tells whether a store hit code
+#define CHECK_CODE(addr) if ((unsigned)(addr) < (unsigned)codeSize) m.codeWritten(addr)
+
+#ifdef EMU_COMPUTED_GOTO
+    DISPATCH();
+#else
+    if (PROFILE) ++hits[pc];
+    for (;;) {
+    if (COUNTED && executed >= limit) STOP(EXIT_COUNT);
+    kind = code[pc].kind;
+redispatch:
+    switch (kind) {
+#endif
+    HANDLER(ldc)
+        b = a; a = code[pc].operand;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(adc)
+        a += code[pc].operand;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(ldl) {
+        int addr = sp + code[pc].operand;
+        b = a;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS);
+        a = mem[addr];
+        ++executed; ++pc; DISPATCH();
+    }
+    HANDLER(stl) {
+        int addr = sp + code[pc].operand;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS);
+        mem[addr] = a;
+        CHECK_CODE(addr);
+        a = b;
+        ++executed; ++pc; DISPATCH();
+    }
+    HANDLER(ldnl) {
+        int addr = a + code[pc].operand;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS);
+        a = mem[addr];
+        ++executed; ++pc; DISPATCH();
+    }
+    HANDLER(stnl) {
+        int addr = a + code[pc].operand;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS);
+        mem[addr] = b;
+        CHECK_CODE(addr);
+        ++executed; ++pc; DISPATCH();
+    }
+    HANDLER(add)
+        a = b + a;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(sub)
+        a = b - a;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(shl)
+        a = b << a;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(shr)
+        a = b >> a;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(adj)
+        sp = sp + code[pc].operand;
+        ++executed; ++pc; CHECK_SP(); DISPATCH();
+    HANDLER(a2sp)
+        sp = a; a = b;
+        ++executed; ++pc; CHECK_SP(); DISPATCH();
+    HANDLER(sp2a)
+        b = a; a = sp;
+        ++executed; ++pc; DISPATCH();
+    HANDLER(call)
+        b = a; a = pc; pc = code[pc].operand;
+        ++executed;
+        if (PROFILE) profiler.enter(pc, executed);
+        CHECK_PC(); DISPATCH();
+    HANDLER(ret)
+        pc = a + 1; a = b;
+        ++executed;
+        if (PROFILE) profiler.leave(executed);
+        CHECK_PC(); DISPATCH();
+    HANDLER(brz)
+        if (a == 0) {
+            if (PROFILE) ++taken[pc];
+            pc += code[pc].operand;
+        }
+        ++executed; ++pc; CHECK_PC(); DISPATCH();
+    HANDLER(brlz)
+        if (a < 0) {
+            if (PROFILE) ++taken[pc];
+            pc += code[pc].operand;
+        }
+        ++executed; ++pc; CHECK_PC(); DISPATCH();
+    HANDLER(br)
+        pc += code[pc].operand;
+        ++executed; ++pc; CHECK_PC(); DISPATCH();
+    HANDLER(HALT)
+        ++executed;
+        STOP(EXIT_HALT);
+    HANDLER(invalid)
+        STOP(EXIT_INVALID_OPCODE);
+    HANDLER(end)
+        STOP(EXIT_SEGFAULT);
+    HANDLER(trap)
+        // The breakpoint the run was resumed from does not stop it again
+        if (!(executed == 0 && pc == m.PC) && m.debug.stopAt(pc, a, b, sp)) STOP(EXIT_BREAKPOINT);
+        REDISPATCH(m.watchedKind(code[pc].opcode));
+    HANDLER(stl_watch) {
+        int addr = sp + code[pc].operand;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS);
+        int old = mem[addr];
+        mem[addr] = a;
+        CHECK_CODE(addr);
+        a = b;
+        ++executed; ++pc;
+        if (m.debug.watchedPages[addr >> Debugger::PAGE_SHIFT] && m.debug.watchHit(addr, old)) {
+            STOP(EXIT_WATCHPOINT);
+        }
+        DISPATCH();
+    }
+    HANDLER(stnl_watch) {
+        int addr = a + code[pc].operand;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS);
+        int old = mem[addr];
+        mem[addr] = b;
+        CHECK_CODE(addr);
+        ++executed; ++pc;
+        if (m.debug.watchedPages[addr >> Debugger::PAGE_SHIFT] && m.debug.watchHit(addr, old)) {
+            STOP(EXIT_WATCHPOINT);
+        }
+        DISPATCH();
+    }
+#ifndef EMU_COMPUTED_GOTO
+    }
+    }
+#endif
+
+stop:
+    m.PC = pc; m.SP = sp; m.regA = a; m.regB = b;
+    m.total += executed;
+    return reason;
+
+#undef HANDLER
+#undef DISPATCH
+#undef REDISPATCH
+#undef STOP
+#undef CHECK_PC
+#undef CHECK_SP
+#undef CHECK_ADDR
+#undef CHECK_CODE
+}
+
+ExitReason runThreaded(Machine &m) {
+    return runThreadedImpl<false>(m);
+}
+
+// Run to HALT like runThreaded() while filling in the profiler's counters
+ExitReason runProfiled(Machine &m) {
+    return runThreadedImpl<true>(m);
+}
+
+// Run like runThreaded() but stop with EXIT_COUNT once count instructions have run
+ExitReason runCounted(Machine &m, long long count) {
+    return runThreadedImpl<false, true>(m, count);
+}
+
+// runThreaded() for the engines that hand a machine to the interpreter, keeping to Machine::limit
+ExitReason runInterpreted(Machine &m) {
+    return (m.limit == LLONG_MAX) ? runThreaded(m) : runCounted(m, m.limit - m.total);
+}
+
+// Superinstructions: opcode pairs and triples the block builder fuses into one handler.
+// Picked from the "emu --ngrams" counts over bubbleSort.txt, test04.txt and the benchmark loops
+const int FUSED_LDL_LDNL = 24;     // ldl k; ldnl m
+const int FUSED_LDC_ADD = 25;      // ldc n; add
+const int FUSED_LDC_STL = 26;      // ldc n; stl k
+const int FUSED_STL_LDL = 27;      // stl k; ldl m
+const int FUSED_LDL_ADC_STL = 28;  // ldl k; adc n; stl m
+const int FUSED_LDL_BRZ = 29;      // ldl k; brz (ends the block)
+const int FUSED_SUB_BRLZ = 30;     // sub; brlz (ends the block)
+const int BLOCK_FALLTHROUGH = 31;  // Closes a block that does not end in a jump
+const int BLOCK_HANDLER_COUNT = 32;
+
+struct BlockEntry;
+
+// One entry of a translated block. Jumps refer to the BlockEntry of their target, so blocks never need the current PC
+struct BlockOp {
+    const void* handler;      // Dispatch target used by runBlocks() (nullptr with the switch fallback)
+    int kind;                 // Opcode, HANDLER_INVALID/HANDLER_END or one of the kinds above
+    int pc;                   // PC of the (first) instruction
+    int operand;              // Operand
+    int operand2;             // Second operand of a superinstruction
+    int operand3;             // Third operand of a superinstruction
+    BlockEntry* taken;        // Block a jump or call goes to
+    BlockEntry* next;         // Block a conditional jump falls through to
+};
+
+// Translated block starting at one PC; first stays null until the block is first entered
+// (and again once a store into the code it was translated from drops it)
+struct BlockEntry {
+    BlockOp* first;
+    int length;               // Instructions the block executes when it runs to its end
+    int pc;                   // Start PC
+    int span;                 // Words from pc on that the translation read
+    BlockOp* storage;         // Ops of the latest translation, reused when the block is translated again
+    int capacity;             // Ops that fit in storage
+};
+
+// Basic blocks of decodedProgram keyed by start PC, translated on first entry.
+// A block ends at br/brz/brlz/call/ret/HALT, an invalid word or the end of the program
+class BlockCache {
+public:
+    static const int MAX_BLOCK = 1024;     // Longest block; longer runs continue in the next one
+    static const int CHUNK_OPS = 1 << 14;  // Ops are stored in chunks that never move once allocated
+    static const int PAGE_SHIFT = 8;       // Code pages of 256 words, the unit invalidate() searches by
+
+    void reset(const Machine &m, const void* const* handlers) {
+        code = m.decodedProgram.data();
+        chunks.clear();
+        chunkUsed = CHUNK_OPS;
+        entries.resize(m.codeSize());
+        for (int pc = 0; pc < (int)entries.size(); ++pc) entries[pc] = {nullptr, 0, pc, 0, nullptr, 0};
+        translatedPages.assign((entries.size() >> PAGE_SHIFT) + 1, 0);
+        codeMarks.assign(entries.size(), 0);
+        outside.clear();
+        this->handlers = handlers;
+    }
+    // Entry for a jump to pc; a PC outside the program gets a block made of a single HANDLER_END op
+    BlockEntry* entry(int pc) {
+        if ((unsigned)pc < entries.size()) return &entries[pc];
+        OutsideBlock &block = outside[pc];
+        if (block.entry.first == nullptr) {
+            block.op = {handlers ? handlers[HANDLER_END] : nullptr, HANDLER_END, pc, 0, 0, 0, nullptr, nullptr};
+            block.entry = {&block.op, 0, pc, 0, nullptr, 0};
+        }
+        return &block.entry;
+    }
+    void build(BlockEntry* block) {
+        int pc = block->pc;
+        scratch.clear();
+        int i = pc;
+        int examined = pc;  // Last word the translation depends on
+        while (true) {
+            int kind = code[i].kind;
+            // Only these kinds look ahead to choose a superinstruction
+            examined = (kind == ldl || kind == ldc || kind == stl || kind == sub) ? i + 2 : i;
+            if (kind >= HANDLER_INVALID) {
+                // Nothing past this point runs, and it does not count as executed
+                emit(i, kind, 0);
+                break;
+            }
+            if (i - pc >= MAX_BLOCK) {
+                // Very long straight-line runs continue in a block of their own
+                emit(i, BLOCK_FALLTHROUGH, 0, 0, 0, nullptr, entry(i));
+                break;
+            }
+            // The sentinel after the last word stops the look-ahead running past the program
+            int next = code[i + 1].kind;
+            int third = (next < HANDLER_INVALID) ? code[i + 2].kind : HANDLER_END;
+            int operand = code[i].operand;
+            if (kind == ldl && next == adc && third == stl) {
+                emit(i, FUSED_LDL_ADC_STL, operand, code[i + 1].operand, code[i + 2].operand);
+                i += 3;
+            } else if (kind == ldl && next == ldnl) {
+                emit(i, FUSED_LDL_LDNL, operand, code[i + 1].operand);
+                i += 2;
+            } else if (kind == ldc && next == add) {
+                emit(i, FUSED_LDC_ADD, operand);
+                i += 2;
+            } else if (kind == ldc && next == stl) {
+                emit(i, FUSED_LDC_STL, operand, code[i + 1].operand);
+                i += 2;
+            } else if (kind == stl && next == ldl) {
+                emit(i, FUSED_STL_LDL, operand, code[i + 1].operand);
+                i += 2;
+            } else if (kind == ldl && next == brz) {
+                emit(i, FUSED_LDL_BRZ, operand, 0, 0, entry(i + 2 + code[i + 1].operand), entry(i + 2));
+                i += 2;
+                break;
+            } else if (kind == sub && next == brlz) {
+                emit(i, FUSED_SUB_BRLZ, 0, 0, 0, entry(i + 2 + code[i + 1].operand), entry(i + 2));
+                i += 2;
+                break;
+            } else if (kind == brz || kind == brlz || kind == br) {
+                emit(i, kind, 0, 0, 0, entry(i + 1 + operand), entry(i + 1));
+                ++i;
+                break;
+            } else if (kind == call) {
+                emit(i, kind, 0, 0, 0, entry(operand));
+                ++i;
+                break;
+            } else if (kind == HALT || kind == ret) {
+                emit(i, kind, 0);
+                ++i;
+                break;
+            } else {
+                emit(i, kind, operand);
+                ++i;
+            }
+        }
+        // Copy the block into chunk storage so pointers to it stay valid as more blocks are added.
+        // A block translated again after a code store takes its old place if it still fits
+        if ((int)scratch.size() > block->capacity) {
+            if (chunkUsed + scratch.size() > CHUNK_OPS) {
+                chunks.emplace_back(new BlockOp[CHUNK_OPS]);
+                chunkUsed = 0;
+            }
+            block->storage = chunks.back().get() + chunkUsed;
+            block->capacity = scratch.size();
+            chunkUsed += scratch.size();
+        }
+        copy(scratch.begin(), scratch.end(), block->storage);
+        block->first = block->storage;
+        block->length = i - pc;
+        block->span = examined - pc + 1;
+        translatedPages[pc >> PAGE_SHIFT] = 1;
+        fill(codeMarks.begin() + pc, codeMarks.begin() + min(pc + block->span, (int)codeMarks.size()), 1);
+    }
+    // Non-zero for the words some translation read. Data words in the program are not marked, so
+    // stores to them only need this one check
+    const char* marks() const { return codeMarks.data(); }
+    // The marked code word at addr changed: drop every translation that read it. Only the pages where
+    // such blocks can start and that have translated blocks at all are searched
+    void invalidate(int addr) {
+        int firstPage = max(0, addr - MAX_BLOCK - 2) >> PAGE_SHIFT;
+        for (int page = addr >> PAGE_SHIFT; page >= firstPage; --page) {
+            if (!translatedPages[page]) continue;
+            int end = min(min((page + 1) << PAGE_SHIFT, (int)entries.size()), addr + 1);
+            for (int pc = page << PAGE_SHIFT; pc < end; ++pc) {
+                BlockEntry &block = entries[pc];
+                if (block.first && addr < pc + block.span) block.first = nullptr;
+            }
+        }
+    }
+
+private:
+    struct OutsideBlock {
+        BlockEntry entry{};
+        BlockOp op;
+    };
+    const DecodedInstr* code = nullptr;
+    vector<BlockEntry> entries;             // One per PC of the program
+    vector<char> translatedPages;           // Code pages where some block has been translated
+    vector<char> codeMarks;                 // See marks(); marks stay when a block is dropped
+    map<int, OutsideBlock> outside;         // Jump targets outside the program (map nodes never move)
+    vector<unique_ptr<BlockOp[]>> chunks;
+    size_t chunkUsed = CHUNK_OPS;
+    vector<BlockOp> scratch;                // Block being translated
+    const void* const* handlers = nullptr;
+
+    void emit(int pc, int kind, int operand, int operand2 = 0, int operand3 = 0, BlockEntry* taken = nullptr,
+              BlockEntry* next = nullptr) {
+        scratch.push_back({handlers ? handlers[kind] : nullptr, kind, pc, operand, operand2, operand3, taken, next});
+    }
+};
+
+// Run to HALT like runThreaded(), but over translated blocks: total is bumped once per block,
+// jumps go straight to the target block, and the fused pairs and triples run as one handler each.
+// A run that aborts part way through a block takes back the count of the instructions that did not run
+ExitReason runBlocks(Machine &m) {
+    int sp = m.SP, a = m.regA, b = m.regB;
+    // Instructions run so far, counted from m.total - m.limit so the check on block entry is a sign test
+    long long executed = m.total - m.limit;
+    int codeSize = m.codeSize();
+    int memSize = m.memory.size();
+    int* mem = m.memory.data();
+    BlockCache cache;
+    const BlockOp* op;
+    BlockEntry* block;
+    ExitReason reason;
+    int stopPc;
+    int written;  // Code word a store hit
+
+#ifdef EMU_COMPUTED_GOTO
+    static const void* const labels[BLOCK_HANDLER_COUNT] = {
+        &&h_ldc, &&h_adc, &&h_ldl, &&h_stl, &&h_ldnl, &&h_stnl, &&h_add, &&h_sub, &&h_shl, &&h_shr,
+        &&h_adj, &&h_a2sp, &&h_sp2a, &&h_call, &&h_ret, &&h_brz, &&h_brlz, &&h_br, &&h_HALT,
+        &&h_invalid, &&h_end,
+        &&h_invalid, &&h_invalid, &&h_invalid,  // Debugger kinds: the interactive prompt only runs runThreaded()
+        &&h_ldl_ldnl, &&h_ldc_add, &&h_ldc_stl, &&h_stl_ldl, &&h_ldl_adc_stl, &&h_ldl_brz, &&h_sub_brlz,
+        &&h_fallthrough};
+    cache.reset(m, labels);
+#define HANDLER(name) h_##name:
+#define DISPATCH() goto *op->handler
+#else
+    cache.reset(m, nullptr);
+#define HANDLER(name) case h_##name:
+#define DISPATCH() continue
+    enum { h_ldc, h_adc, h_ldl, h_stl, h_ldnl, h_stnl, h_add, h_sub, h_shl, h_shr, h_adj, h_a2sp,
+           h_sp2a, h_call, h_ret, h_brz, h_brlz, h_br, h_HALT, h_invalid, h_end, h_trap, h_stl_watch,
+           h_stnl_watch, h_ldl_ldnl, h_ldc_add, h_ldc_stl, h_stl_ldl, h_ldl_adc_stl, h_ldl_brz, h_sub_brlz,
+           h_fallthrough };
+#endif
+    const char* marks = cache.marks();
+
+#define NEXT() ++op; DISPATCH()
+// Leave the current block for the given one
+#define ENTER(target) block = (target); goto enter
+// Stop after the first `done` instructions of the current op have run
+#define STOP(why, done) { reason = why; stopPc = op->pc + (done); goto stop; }
+#define CHECK_SP() if (sp > stackLimit) STOP(EXIT_OVERFLOW, 1)
+#define CHECK_ADDR(addr, why, done) if ((unsigned)(addr) >= (unsigned)memSize) STOP(why, done)
+// After a store to addr by the first `done` instructions of the op: a store into the program is decoded
+// again, and one that hit translated code leaves the block through codeStore
+#define CHECK_CODE(addr, done) if ((unsigned)(addr) < (unsigned)codeSize) { \
+        m.codeWritten(addr); \
+        if (marks[addr]) { written = (addr); stopPc = op->pc + (done); goto codeStore; } }
+
+    block = cache.entry(m.PC);
+enter:
+    if (executed >= 0) goto yield;
+    if (block->first == nullptr) cache.build(block);
+    op = block->first;
+    executed += block->length;
+#ifdef EMU_COMPUTED_GOTO
+    DISPATCH();
+#else
+    for (;;) switch (op->kind) {
+#endif
+    HANDLER(ldc)
+        b = a; a = op->operand;
+        NEXT();
+    HANDLER(adc)
+        a += op->operand;
+        NEXT();
+    HANDLER(ldl) {
+        int addr = sp + op->operand;
+        b = a;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        a = mem[addr];
+        NEXT();
+    }
+    HANDLER(stl) {
+        int addr = sp + op->operand;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        mem[addr] = a;
+        a = b;
+        CHECK_CODE(addr, 1);
+        NEXT();
+    }
+    HANDLER(ldnl) {
+        int addr = a + op->operand;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS, 0);
+        a = mem[addr];
+        NEXT();
+    }
+    HANDLER(stnl) {
+        int addr = a + op->operand;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS, 0);
+        mem[addr] = b;
+        CHECK_CODE(addr, 1);
+        NEXT();
+    }
+    HANDLER(add)
+        a = b + a;
+        NEXT();
+    HANDLER(sub)
+        a = b - a;
+        NEXT();
+    HANDLER(shl)
+        a = b << a;
+        NEXT();
+    HANDLER(shr)
+        a = b >> a;
+        NEXT();
+    HANDLER(adj)
+        sp = sp + op->operand;
+        CHECK_SP(); NEXT();
+    HANDLER(a2sp)
+        sp = a; a = b;
+        CHECK_SP(); NEXT();
+    HANDLER(sp2a)
+        b = a; a = sp;
+        NEXT();
+    HANDLER(call)
+        b = a; a = op->pc;
+        ENTER(op->taken);
+    HANDLER(ret)
+        block = cache.entry(a + 1); a = b;
+        goto enter;
+    HANDLER(brz)
+        ENTER(a == 0 ? op->taken : op->next);
+    HANDLER(brlz)
+        ENTER(a < 0 ? op->taken : op->next);
+    HANDLER(br)
+        ENTER(op->taken);
+    HANDLER(HALT)
+        // HALT ends its block, so the block's count is already exact
+        m.PC = op->pc; m.SP = sp; m.regA = a; m.regB = b;
+        m.total = m.limit + executed;
+        return EXIT_HALT;
+    HANDLER(invalid)
+        STOP(EXIT_INVALID_OPCODE, 0);
+    HANDLER(end)
+        STOP(EXIT_SEGFAULT, 0);
+    // The fused handlers leave the registers as the separate instructions would if one of them faults
+    HANDLER(ldl_ldnl) {
+        int addr = sp + op->operand;
+        b = a;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        a = mem[addr];
+        addr = a + op->operand2;
+        CHECK_ADDR(addr, EXIT_BAD_A_ACCESS, 1);
+        a = mem[addr];
+        NEXT();
+    }
+    HANDLER(ldc_add)
+        b = a; a += op->operand;
+        NEXT();
+    HANDLER(ldc_stl) {
+        int addr = sp + op->operand2;
+        b = a;
+        if ((unsigned)addr >= (unsigned)memSize) {
+            a = op->operand;
+            STOP(EXIT_BAD_SP_ACCESS, 1);
+        }
+        mem[addr] = op->operand;
+        CHECK_CODE(addr, 2);
+        NEXT();
+    }
+    HANDLER(stl_ldl) {
+        int addr = sp + op->operand;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        mem[addr] = a;
+        a = b;
+        CHECK_CODE(addr, 1);
+        addr = sp + op->operand2;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 1);
+        a = mem[addr];
+        NEXT();
+    }
+    HANDLER(ldl_adc_stl) {
+        // Adds a constant to a local and stores it in another; regA and regB end up holding the old regA
+        int addr = sp + op->operand;
+        b = a;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        int value = mem[addr] + op->operand2;
+        addr = sp + op->operand3;
+        if ((unsigned)addr >= (unsigned)memSize) {
+            a = value;
+            STOP(EXIT_BAD_SP_ACCESS, 2);
+        }
+        mem[addr] = value;
+        CHECK_CODE(addr, 3);
+        NEXT();
+    }
+    HANDLER(ldl_brz) {
+        int addr = sp + op->operand;
+        b = a;
+        CHECK_ADDR(addr, EXIT_BAD_SP_ACCESS, 0);
+        a = mem[addr];
+        ENTER(a == 0 ? op->taken : op->next);
+    }
+    HANDLER(sub_brlz)
+        a = b - a;
+        ENTER(a < 0 ? op->taken : op->next);
+    HANDLER(fallthrough)
+        ENTER(op->next);
+#ifndef EMU_COMPUTED_GOTO
+    }
+#endif
+
+codeStore:
+    // A store hit translated code: drop the translations that read the word and go on in a fresh block
+    // after the instruction that stored
+    executed -= block->length - (stopPc - block->pc);
+    cache.invalidate(written);
+    ENTER(cache.entry(stopPc));
+
+stop:
+    executed -= block->length - (stopPc - block->pc);
+    m.PC = stopPc; m.SP = sp; m.regA = a; m.regB = b;
+    m.total = m.limit + executed;
+    return reason;
+
+yield:
+    // Out of budget: stop before the block about to be entered
+    m.PC = block->pc; m.SP = sp; m.regA = a; m.regB = b;
+    m.total = m.limit + executed;
+    return EXIT_COUNT;
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef ENTER
+#undef STOP
+#undef CHECK_SP
+#undef CHECK_ADDR
+#undef CHECK_CODE
+}
+
+// Basic-block JIT for Linux x86-64 ("--jit"). Blocks end at br/brz/brlz/call/ret/HALT and are compiled on
+// first use into an executable mapping. While inside compiled code regA, regB and SP live in ebx, r12d
+// and r13d, the executed count in r14 and the memory base in r15; rbp points at the JitState.
+// Direct branches are chained by patching the jump at the end of a block once its target is compiled,
+// and ret looks its target up in the block table without leaving compiled code.
+// Faults leave through a stub per check that stores the faulting PC and takes back the part of the block
+// that did not run. Blocks are compiled from guest memory; a store into the program checks the word's
+// mark out of line and only leaves, the same way, when compiled code was read from it. Words the JIT does not translate (invalid opcodes, running off the end) and a full code
+// buffer hand the machine back to the interpreter
+#if defined(__x86_64__) && defined(__linux__) && !defined(EMU_NO_JIT)
+#define EMU_JIT 1
+#endif
+
+#ifdef EMU_JIT
+// Machine state shared between the dispatcher and compiled code
+struct JitState {
+    int a, b, sp, pc;
+    int written;          // Code word a store hit (with JIT_CODE_STORE)
+    long long executed;
+    int* mem;
+    long long limit;      // Every block leaves with EXIT_COUNT on entry once executed has reached this
+};
+
+class Jit {
+public:
+    static const size_t CODE_BYTES = 64 << 20;    // Size of the executable mapping
+    static const int MAX_BLOCK = 1024;            // Longest block; longer runs continue in the next one
+    // Upper bound of the code emitted for one instruction, stubs included. The largest is stl: 36 bytes inline
+    // (address check, store, code check), 19 for its bad-address stub and 42 for its code-store stub
+    static const int MAX_INSTR_BYTES = 104;
+    static const size_t BLOCK_BYTES = (MAX_BLOCK + 4) * MAX_INSTR_BYTES;  // Reserved for a block (and its entry check)
+    static const int PAGE_SHIFT = 8;              // Code pages searched by invalidate(), as in BlockCache
+    static const int JIT_CODE_STORE = EXIT_DEADLINE + 1;  // enter() result: a store hit the program
+
+    // Map the code buffer and emit the entry/exit stubs; returns false if executable memory is not available
+    bool init(const Machine &m) {
+        void* mapped = mmap(nullptr, CODE_BYTES, PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapped == MAP_FAILED) return false;
+        buffer = static_cast<uint8_t*>(mapped);
+        size = 0;
+        words = m.memory.words;
+        codeSize = m.codeSize();
+        memSize = m.memory.size();
+        blockEntry.assign(codeSize, nullptr);
+        blockSpan.assign(codeSize, 0);
+        codeMarks.assign(codeSize, 0);
+        translatedPages.assign((codeSize >> PAGE_SHIFT) + 1, 0);
+        links.assign(codeSize, {});
+        emitStubs();
+        return true;
+    }
+    ~Jit() {
+        if (buffer) munmap(buffer, CODE_BYTES);
+    }
+    // Run compiled code from state.pc until it leaves with an ExitReason other than EXIT_NONE or JIT_CODE_STORE
+    int enter(JitState &state, const uint8_t* block) {
+        return reinterpret_cast<int (*)(JitState*, const uint8_t*)>(prologue)(&state, block);
+    }
+    // Compiled block starting at pc (compiling it first if needed); nullptr if the word there is not translated
+    const uint8_t* block(int pc) {
+        if (blockEntry[pc] == nullptr) compile(pc);
+        return blockEntry[pc];
+    }
+    // The code word at addr changed: every block compiled from it is dropped, and the exits chained to it go
+    // back to the dispatcher until the block is compiled again
+    void invalidate(int addr) {
+        int firstPage = max(0, addr - MAX_BLOCK) >> PAGE_SHIFT;
+        for (int page = addr >> PAGE_SHIFT; page >= firstPage; --page) {
+            if (!translatedPages[page]) continue;
+            int end = min(min((page + 1) << PAGE_SHIFT, codeSize), addr + 1);
+            for (int pc = page << PAGE_SHIFT; pc < end; ++pc) {
+                if (blockEntry[pc] == nullptr || addr >= pc + blockSpan[pc]) continue;
+                for (uint8_t* field : links[pc]) patch(field, exitContinue);
+                blockEntry[pc] = nullptr;
+            }
+        }
+    }
+
+private:
+    uint8_t* buffer = nullptr;
+    size_t size = 0;
+    const int* words = nullptr;               // Guest memory, where the program is compiled from
+    int codeSize = 0;
+    int memSize = 0;
+    vector<uint8_t*> blockEntry;              // Compiled block for every start PC (nullptr if none yet)
+    vector<int> blockSpan;                    // Words from the start PC that the block was compiled from
+    vector<char> translatedPages;             // Code pages where some block has been compiled
+    vector<char> codeMarks;                   // Non-zero for the words some compiled block was read from
+    vector<vector<uint8_t*>> links;           // rel32 fields of exits to the block at that PC (chained or waiting)
+    uint8_t* prologue = nullptr;              // int enter(JitState*, const uint8_t* block)
+    uint8_t* exitContinue = nullptr;          // Return EXIT_NONE (state.pc already stored)
+    uint8_t* exitCode[JIT_CODE_STORE + 1] = {};  // Return the given ExitReason (or JIT_CODE_STORE)
+
+    // Fault exit of the block being compiled, emitted after its code
+    struct FaultExit {
+        size_t field;         // rel32 of the conditional jump to the stub
+        size_t resume;        // Where a code store that hit no compiled code carries on
+        int reason;
+        int pc;               // PC the machine stops at
+        int uncounted;        // Instructions of the block that did not run
+    };
+    vector<FaultExit> faults;
+
+    // Host registers
+    enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+           R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+    static const int REG_A = RBX, REG_B = R12, REG_SP = R13;
+
+    void byte(uint8_t value) { buffer[size++] = value; }
+    void dword(uint32_t value) {
+        memcpy(buffer + size, &value, 4);
+        size += 4;
+    }
+    void qword(uint64_t value) {
+        memcpy(buffer + size, &value, 8);
+        size += 8;
+    }
+    // Optional REX prefix for a ModRM instruction with the given reg and rm registers
+    void rex(bool wide, int reg, int rm) {
+        uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (prefix != 0x40) byte(prefix);
+    }
+    // "op rm, reg" between registers (32 bit unless wide)
+    void opRegReg(uint8_t opcode, int rm, int reg, bool wide = false) {
+        rex(wide, reg, rm);
+        byte(opcode);
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+    void movRegReg(int dst, int src) { opRegReg(0x89, dst, src); }
+    void movRegImm(int dst, int32_t value) {
+        rex(false, 0, dst);
+        byte(0xB8 | (dst & 7));
+        dword(value);
+    }
+    // "op rm, imm32" with the /digit form of opcode 81 (0 = add, 7 = cmp)
+    void aluRegImm(int digit, int rm, int32_t value, bool wide = false) {
+        rex(wide, 0, rm);
+        byte(0x81);
+        byte(0xC0 | (digit << 3) | (rm & 7));
+        dword(value);
+    }
+    // Load/store a 32 bit field of the JitState ([rbp + offset])
+    void stateAccess(uint8_t opcode, int reg, int offset, bool wide = false) {
+        rex(wide, reg, RBP);
+        byte(opcode);
+        byte(0x40 | ((reg & 7) << 3) | RBP);
+        byte(offset);
+    }
+    // eax = base + displacement (32 bit, wraps like the interpreter's int arithmetic)
+    void leaEax(int base, int32_t displacement) {
+        rex(false, RAX, base);
+        byte(0x8D);
+        byte(0x80 | (base & 7));  // mod 10, reg eax, rm base (rbx/r13 need no SIB)
+        dword(displacement);
+    }
+    // "op reg, [r15 + rax*4]" (8B loads, 89 stores)
+    void memoryAccess(uint8_t opcode, int reg) {
+        rex(false, reg, R15);
+        byte(opcode);
+        byte(0x04 | ((reg & 7) << 3));
+        byte(0x87);  // scale 4, index rax, base r15
+    }
+    // Jump (0xE9) or conditional jump (0x0F 0x8x) with a rel32 to target; returns the offset of the rel32
+    size_t jump(const uint8_t* target, int condition = -1) {
+        if (condition < 0) {
+            byte(0xE9);
+        } else {
+            byte(0x0F);
+            byte(0x80 | condition);
+        }
+        size_t field = size;
+        dword(static_cast<uint32_t>(target - (buffer + size + 4)));
+        return field;
+    }
+    void patch(uint8_t* field, const uint8_t* target) {
+        int32_t rel = static_cast<int32_t>(target - (field + 4));
+        memcpy(field, &rel, 4);
+    }
+
+    enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_NS = 0x9, CC_GE = 0xD, CC_G = 0xF };
+
+    void emitStubs() {
+        // Prologue: save callee-saved registers, load the machine state and jump to the block (rsi)
+        prologue = buffer + size;
+        byte(0x53);                          // push rbx
+        byte(0x55);                          // push rbp
+        byte(0x41); byte(0x54);              // push r12
+        byte(0x41); byte(0x55);              // push r13
+        byte(0x41); byte(0x56);              // push r14
+        byte(0x41); byte(0x57);              // push r15
+        byte(0x48); byte(0x83); byte(0xEC); byte(0x08);  // sub rsp, 8 (keeps the stack 16-byte aligned)
+        opRegReg(0x89, RBP, RDI, true);      // mov rbp, rdi
+        stateAccess(0x8B, REG_A, offsetof(JitState, a));
+        stateAccess(0x8B, REG_B, offsetof(JitState, b));
+        stateAccess(0x8B, REG_SP, offsetof(JitState, sp));
+        stateAccess(0x8B, R14, offsetof(JitState, executed), true);
+        stateAccess(0x8B, R15, offsetof(JitState, mem), true);
+        byte(0xFF); byte(0xE6);              // jmp rsi
+        // Exits: eax = reason, then store the registers back and return
+        uint8_t* epilogue = nullptr;
+        for (int reason = JIT_CODE_STORE; reason >= 0; --reason) {
+            exitCode[reason] = buffer + size;
+            movRegImm(RAX, reason);
+            if (epilogue == nullptr) {
+                epilogue = buffer + size;
+                stateAccess(0x89, REG_A, offsetof(JitState, a));
+                stateAccess(0x89, REG_B, offsetof(JitState, b));
+                stateAccess(0x89, REG_SP, offsetof(JitState, sp));
+                stateAccess(0x89, R14, offsetof(JitState, executed), true);
+                byte(0x48); byte(0x83); byte(0xC4); byte(0x08);  // add rsp, 8
+                byte(0x41); byte(0x5F);      // pop r15
+                byte(0x41); byte(0x5E);      // pop r14
+                byte(0x41); byte(0x5D);      // pop r13
+                byte(0x41); byte(0x5C);      // pop r12
+                byte(0x5D);                  // pop rbp
+                byte(0x5B);                  // pop rbx
+                byte(0xC3);                  // ret
+            } else {
+                jump(epilogue);
+            }
+        }
+        exitContinue = exitCode[EXIT_NONE];
+    }
+
+    // Leave the block for a known PC: chained straight to its block if compiled, else back to the dispatcher
+    void exitTo(int target) {
+        // state.pc is only read by the dispatcher, so it is stored even when the jump is chained
+        storePc(target);
+        bool inside = target >= 0 && target < codeSize;
+        size_t field = jump(inside && blockEntry[target] ? blockEntry[target] : exitContinue);
+        if (inside) links[target].push_back(buffer + field);
+    }
+    void storePc(int pc) {
+        rex(false, 0, RBP);
+        byte(0xC7); byte(0x45); byte(offsetof(JitState, pc));  // mov dword [rbp + pc], pc
+        dword(pc);
+    }
+    // Bounds check of the address in eax, as CHECK_ADDR does; a fault stops at the instruction at pc
+    void checkAddress(ExitReason reason, int pc, int blockEnd) {
+        byte(0x3D);                          // cmp eax, imm32
+        dword(memSize);
+        faults.push_back({jump(buffer, CC_AE), 0, reason, pc, blockEnd - pc});
+    }
+    // An overflow stops after the instruction at pc, which counts as executed
+    void checkStack(int pc, int blockEnd) {
+        aluRegImm(7, REG_SP, stackLimit);    // cmp r13d, stackLimit
+        faults.push_back({jump(buffer, CC_G), 0, EXIT_OVERFLOW, pc + 1, blockEnd - pc - 1});
+    }
+    // After the store of the instruction at pc to the address in eax: a store into the program goes on to
+    // the mark check in its stub
+    void checkCode(int pc, int blockEnd) {
+        byte(0x3D);                          // cmp eax, codeSize
+        dword(codeSize);
+        size_t field = jump(buffer, CC_B);
+        faults.push_back({field, size, JIT_CODE_STORE, pc + 1, blockEnd - pc - 1});
+    }
+    DecodedInstr fetch(int pc) const {
+        return pc < codeSize ? Machine::decode(words[pc]) : DecodedInstr{nullptr, HANDLER_END, 0, 0};
+    }
+
+    // Translate the block starting at pc; leaves blockEntry[pc] null if its first word is not translated
+    void compile(int pc) {
+        if (fetch(pc).kind >= HANDLER_INVALID) return;
+        if (size + BLOCK_BYTES > CODE_BYTES) return;  // Buffer full: interpreter from here
+        uint8_t* entry = buffer + size;
+        // Count the block's instructions up front; only errors (which end the run) leave part way through
+        int length = 0;
+        while (length < MAX_BLOCK && fetch(pc + length).kind < HANDLER_INVALID) {
+            int kind = fetch(pc + length++).kind;
+            if (kind == br || kind == brz || kind == brlz || kind == call || kind == ret || kind == HALT) break;
+        }
+        faults.clear();
+        // Out of budget: leave before the block runs
+        stateAccess(0x3B, R14, offsetof(JitState, limit), true);  // cmp r14, [rbp + limit]
+        faults.push_back({jump(buffer, CC_GE), 0, EXIT_COUNT, pc, 0});
+        aluRegImm(0, R14, length, true);     // add r14, length
+        int end = pc + length;
+        for (int i = pc; i < end; ++i) {
+            int operand = fetch(i).operand;
+            switch (fetch(i).kind) {
+            case ldc:
+                movRegReg(REG_B, REG_A);
+                movRegImm(REG_A, operand);
+                break;
+            case adc:
+                aluRegImm(0, REG_A, operand);
+                break;
+            case ldl:
+                movRegReg(REG_B, REG_A);
+                leaEax(REG_SP, operand);
+                checkAddress(EXIT_BAD_SP_ACCESS, i, end);
+                memoryAccess(0x8B, REG_A);
+                break;
+            case stl:
+                leaEax(REG_SP, operand);
+                checkAddress(EXIT_BAD_SP_ACCESS, i, end);
+                memoryAccess(0x89, REG_A);
+                movRegReg(REG_A, REG_B);
+                checkCode(i, end);
+                break;
+            case ldnl:
+                leaEax(REG_A, operand);
+                checkAddress(EXIT_BAD_A_ACCESS, i, end);
+                memoryAccess(0x8B, REG_A);
+                break;
+            case stnl:
+                leaEax(REG_A, operand);
+                checkAddress(EXIT_BAD_A_ACCESS, i, end);
+                memoryAccess(0x89, REG_B);
+                checkCode(i, end);
+                break;
+            case add:
+                opRegReg(0x01, REG_A, REG_B);    // add ebx, r12d
+                break;
+            case sub:
+                movRegReg(RAX, REG_B);
+                opRegReg(0x29, RAX, REG_A);      // sub eax, ebx
+                movRegReg(REG_A, RAX);
+                break;
+            case shl:
+            case shr:
+                // Shift counts are masked to 5 bits, as the interpreter's shifts are on x86
+                movRegReg(RCX, REG_A);
+                movRegReg(RAX, REG_B);
+                byte(0xD3);
+                byte(fetch(i).kind == shl ? 0xE0 : 0xF8);  // shl eax, cl / sar eax, cl
+                movRegReg(REG_A, RAX);
+                break;
+            case adj:
+                aluRegImm(0, REG_SP, operand);
+                checkStack(i, end);
+                break;
+            case a2sp:
+                movRegReg(REG_SP, REG_A);
+                movRegReg(REG_A, REG_B);
+                checkStack(i, end);
+                break;
+            case sp2a:
+                movRegReg(REG_B, REG_A);
+                movRegReg(REG_A, REG_SP);
+                break;
+            case call:
+                movRegReg(REG_B, REG_A);
+                movRegImm(REG_A, i);
+                exitTo(operand);
+                break;
+            case ret: {
+                leaEax(REG_A, 1);
+                movRegReg(REG_A, REG_B);
+                // Stay in compiled code if the return address already has a block
+                byte(0x3D);                      // cmp eax, codeSize
+                dword(codeSize);
+                size_t outside = jump(buffer, CC_AE);
+                byte(0x48); byte(0xB9);          // mov rcx, blockEntry.data()
+                qword(reinterpret_cast<uint64_t>(blockEntry.data()));
+                byte(0x48); byte(0x8B); byte(0x0C); byte(0xC1);  // mov rcx, [rcx + rax*8]
+                byte(0x48); byte(0x85); byte(0xC9);              // test rcx, rcx
+                size_t missing = jump(buffer, CC_E);
+                byte(0xFF); byte(0xE1);          // jmp rcx
+                patch(buffer + outside, buffer + size);
+                patch(buffer + missing, buffer + size);
+                stateAccess(0x89, RAX, offsetof(JitState, pc));  // mov [rbp + pc], eax
+                jump(exitContinue);
+                break;
+            }
+            case brz:
+            case brlz: {
+                byte(0x85); byte(0xDB);          // test ebx, ebx
+                size_t notTaken = jump(buffer, fetch(i).kind == brz ? CC_NE : CC_NS);
+                exitTo(i + 1 + operand);
+                patch(buffer + notTaken, buffer + size);
+                exitTo(i + 1);
+                break;
+            }
+            case br:
+                exitTo(i + 1 + operand);
+                break;
+            case HALT:
+                storePc(i);
+                jump(exitCode[EXIT_HALT]);
+                break;
+            }
+        }
+        // A block cut short by its length or by an untranslated word carries on at the next PC
+        int last = fetch(pc + length - 1).kind;
+        if (last != br && last != brz && last != brlz && last != call && last != ret && last != HALT) {
+            exitTo(pc + length);
+        }
+        for (const FaultExit &fault : faults) {
+            patch(buffer + fault.field, buffer + size);
+            if (fault.reason == JIT_CODE_STORE) {
+                byte(0x48); byte(0xB9);          // mov rcx, codeMarks.data()
+                qword(reinterpret_cast<uint64_t>(codeMarks.data()));
+                byte(0x80); byte(0x3C); byte(0x01); byte(0x00);  // cmp byte [rcx + rax], 0
+                jump(buffer + fault.resume, CC_E);
+                stateAccess(0x89, RAX, offsetof(JitState, written));
+            }
+            storePc(fault.pc);
+            if (fault.uncounted) aluRegImm(5, R14, fault.uncounted, true);  // sub r14, uncounted
+            jump(exitCode[fault.reason]);
+        }
+        // The reservation is all that keeps compiled code inside the buffer; a block that outgrew it may have
+        // written past the mapping, so nothing it produced can be trusted
+        if (buffer + size - entry > (ptrdiff_t)BLOCK_BYTES) {
+            fprintf(stderr, "JIT: block at %d took %td bytes, more than the %zu reserved\n", pc, buffer + size - entry, BLOCK_BYTES);
+            abort();
+        }
+        blockEntry[pc] = entry;
+        blockSpan[pc] = (last == br || last == brz || last == brlz || last == call || last == ret || last == HALT)
+                        ? length : length + 1;  // Else the word after the block was read as well
+        fill(codeMarks.begin() + pc, codeMarks.begin() + min(pc + blockSpan[pc], codeSize), 1);
+        translatedPages[pc >> PAGE_SHIFT] = 1;
+        // Chain the exits to this block (those of dropped blocks are patched too, which is harmless)
+        for (uint8_t* field : links[pc]) patch(field, entry);
+    }
+};
+
+// Run to HALT like runThreaded(), executing compiled blocks; falls back to the interpreter when needed
+ExitReason runJit(Machine &m) {
+    int codeSize = m.codeSize();
+    Jit jit;
+    if (codeSize == 0 || !jit.init(m)) return runInterpreted(m);
+    JitState state = {m.regA, m.regB, m.SP, m.PC, 0, 0, m.memory.data(), m.limit - m.total};
+    while (true) {
+        const uint8_t* block = (unsigned)state.pc < (unsigned)codeSize ? jit.block(state.pc) : nullptr;
+        int reason = EXIT_NONE;
+        if (block) reason = jit.enter(state, block);
+        if (block && reason == Jit::JIT_CODE_STORE) {
+            jit.invalidate(state.written);
+            continue;
+        }
+        if (block && reason == EXIT_NONE) continue;
+        m.regA = state.a; m.regB = state.b; m.SP = state.sp; m.PC = state.pc;
+        m.total += state.executed;
+        m.decodeProgram();  // Compiled stores do not keep decodedProgram up to date
+        if (block) return static_cast<ExitReason>(reason);
+        // Untranslated word (or a PC outside the program): let the interpreter take over from here
+        if ((unsigned)m.PC >= (unsigned)codeSize) return EXIT_SEGFAULT;
+        return runInterpreted(m);
+    }
+}
+#else
+// No JIT on this platform: --jit runs the interpreter
+ExitReason runJit(Machine &m) {
+    return runInterpreted(m);
+}
+#endif
+
+// Instruction budget and wall-clock deadline of a run ("--budget N", "--deadline SECONDS"). The engines only
+// see Machine::limit, which they check once per block; runLimited() hands them the run in slices and reads
+// the clock between slices, so a limit costs one compare per block and the run stops within a slice of it
+struct RunLimits {
+    static const long long SLICE = 1 << 24;  // Instructions between two looks at the clock
+    long long budget = LLONG_MAX;            // Instructions, counted in Machine::total
+    double deadline = 0;                     // Seconds of run time (0: none)
+
+    bool any() const { return budget != LLONG_MAX || deadline > 0; }
+};
+RunLimits runLimits;  // From the command line
+
+// Parse "--budget N" and "--deadline SECONDS" at argv[i]; advances i past the value. False for other options
+bool readRunLimit(int argc, char* argv[], int &i, RunLimits &limits) {
+    string option = argv[i];
+    if (i + 1 >= argc || (option != "--budget" && option != "--deadline")) return false;
+    char* end;
+    if (option == "--budget") limits.budget = strtoll(argv[i + 1], &end, 0);
+    else limits.deadline = strtod(argv[i + 1], &end);
+    if (*end != '\0' || limits.budget < 0 || limits.deadline < 0) return false;
+    ++i;
+    return true;
+}
+
+// Run m for up to slice more instructions (never past the budget) and add the time it took to seconds.
+// Returns EXIT_COUNT if the run can go on, EXIT_BUDGET or EXIT_DEADLINE once a limit is reached, and
+// otherwise how the program stopped. The engine must keep to Machine::limit (runBlocks(), runJit())
+ExitReason runSlice(ExitReason (*engine)(Machine&), Machine &m, const RunLimits &limits, long long slice,
+                    double &seconds) {
+    auto start = chrono::steady_clock::now();
+    m.limit = min(limits.budget, m.total + slice);
+    ExitReason reason = engine(m);
+    m.limit = LLONG_MAX;
+    seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (reason != EXIT_COUNT) return reason;
+    if (m.total >= limits.budget) return EXIT_BUDGET;
+    if (limits.deadline > 0 && seconds >= limits.deadline) return EXIT_DEADLINE;
+    return EXIT_COUNT;
+}
+
+// Run m to HALT (or an error) with the engine, stopping with EXIT_BUDGET or EXIT_DEADLINE at the limits
+ExitReason runLimited(ExitReason (*engine)(Machine&), Machine &m, const RunLimits &limits) {
+    if (!limits.any()) return engine(m);
+    double seconds = 0;
+    ExitReason reason;
+    while ((reason = runSlice(engine, m, limits, RunLimits::SLICE, seconds)) == EXIT_COUNT) {}
+    return reason;
+}
+
+// A run that reached its budget or deadline reports where the guest was and leaves with the status
+// timeout(1) uses, so a runaway program can be told apart from one that failed
+void exitOnLimit(Machine &m, ExitReason reason) {
+    if (reason != EXIT_BUDGET && reason != EXIT_DEADLINE) return;
+    cout << (reason == EXIT_BUDGET ? "Instruction budget exhausted" : "Deadline exceeded") << ". Aborting.\n";
+    printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", m.regA, m.regB, m.PC, m.SP);
+    printf("Total instructions executed: %lld\n", m.total);
+    if ((unsigned)m.PC < (unsigned)m.codeSize()) {
+        DecodedInstr next = Machine::decode(m.memory[m.PC]);
+        const char* name = (next.opcode < (int)mnemonics.size()) ? mnemonics[next.opcode].c_str() : "?";
+        printf("Next instruction: %s %d\n", name, next.operand);
+    }
+    printf("Stack:");
+    for (int i = 0; i < 8 && (unsigned)(m.SP + i) < m.memory.size(); ++i) printf(" %08X", m.memory[m.SP + i]);
+    printf("\n");
+    exit(124);
+}
+
 pair<long, bool> read_operand(const std::string &operand) {
     if (operand.empty()) {
         return {0, false};  // Return default pair if operand is empty
@@ -240,7 +2000,7 @@ pair<long, bool> read_operand(const std::string &operand) {
     return {-1, false};
 }
 
-void dump() {
+void dump(Machine &m) {
     std::string operand, offset;
     
     // Prompt for and read the base address
@@ -264,14 +2024,53 @@ void dump() {
     int numValues = offsetResult.first;
     // Output memory content in blocks of 4
     for (int i = baseAddress; i < baseAddress + numValues; i += 4) {
-        if (i + 3 >= (int)memory.size()) {
+        if (i + 3 >= (int)m.memory.size()) {
             std::cerr << "Memory access out of bounds at address " << i << ". Aborting.\n";
             return;
         }
-        printf("%08X %08X %08X %08X %08X\n", i, memory[i], memory[i + 1], memory[i + 2], memory[i + 3]);
+        printf("%08X %08X %08X %08X %08X\n", i, m.memory[i], m.memory[i + 1], m.memory[i + 2], m.memory[i + 3]);
     }
 }
-int advance() {
+// Parse a breakpoint condition such as "A==5", "B < 0" or "SP>=100"; an empty one always stops
+bool read_condition(std::string text, Debugger::Breakpoint &bp) {
+    text.erase(std::remove_if(text.begin(), text.end(), ::isspace), text.end());
+    if (text.empty()) return true;
+    std::transform(text.begin(), text.end(), text.begin(), ::toupper);
+    size_t length = (text.compare(0, 2, "SP") == 0) ? 2 : 1;
+    if (length == 1 && text[0] != 'A' && text[0] != 'B') return false;
+    size_t opLength = text.find_first_not_of("=!<>", length);
+    if (opLength == std::string::npos) return false;
+    bp.reg = text[0];
+    bp.op = text.substr(length, opLength - length);
+    if (bp.op != "==" && bp.op != "!=" && bp.op != "<" && bp.op != "<=" && bp.op != ">" && bp.op != ">=") {
+        return false;
+    }
+    auto value = read_operand(text.substr(opLength));
+    bp.value = value.first;
+    return value.second;
+}
+
+// Run from the prompt until HALT, a fault, a breakpoint or a watchpoint, or after count instructions
+// if count is not 0. Prints where it stopped; returns 0 once the program has halted
+int debugRun(Machine &m, long long count) {
+    ExitReason reason = count ? runCounted(m, count) : runThreaded(m);
+    vector<int> temporary;
+    for (const auto &bp : m.debug.breakpoints) {
+        if (bp.second.temporary) temporary.push_back(bp.first);
+    }
+    for (int pc : temporary) m.clearBreakpoint(pc);
+    exitOnError(reason);
+    if (reason == EXIT_BREAKPOINT) {
+        printf("Breakpoint at %08X\n", m.PC);
+    } else if (reason == EXIT_WATCHPOINT) {
+        printf("Watchpoint at %08X: %08X -> %08X\n", m.debug.hitAddress, m.debug.hitOld,
+               m.memory[m.debug.hitAddress]);
+    }
+    printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", m.regA, m.regB, m.PC, m.SP);
+    return reason != EXIT_HALT;
+}
+
+int advance(Machine &m) {
     std::string temp;
     std::cout << "Emulator input: ";
     std::cin >> temp;
@@ -280,50 +2079,973 @@ int advance() {
 
     if (temp == "-t") {
         // Single-step execution with register status printout
-        if (argumentrun()) {
-            printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", regA, regB, PC, SP);
+        if (argumentrun(m)) {
+            printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", m.regA, m.regB, m.PC, m.SP);
             return 1;  // Continue execution
         }
         return 0;  // End of execution
     } 
     else if (temp == "-all") {
-        // Full execution until a stopping condition
-        while (argumentrun()) {
-            printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", regA, regB, PC, SP);
+        // Full execution until a stopping condition, or until the --budget/--deadline limits are reached
+        auto start = chrono::steady_clock::now();
+        while (argumentrun(m)) {
+            printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", m.regA, m.regB, m.PC, m.SP);
+            if (m.total >= runLimits.budget) exitOnLimit(m, EXIT_BUDGET);
+            // The clock is only read every 4096 instructions
+            if (runLimits.deadline > 0 && (m.total & 0xFFF) == 0 &&
+                chrono::duration<double>(chrono::steady_clock::now() - start).count() >= runLimits.deadline) {
+                exitOnLimit(m, EXIT_DEADLINE);
+            }
         }
         return 0;
     } 
     else if (temp == "-dump") {
         // Dump memory contents
-        dump();
+        dump(m);
         return 1;  // Return to prompt for next command
     } 
+    else if (temp == "-break") {
+        // Breakpoint at an address, optionally followed by a condition on A, B or SP on the same line
+        std::string operand, condition;
+        std::cout << "Breakpoint address: ";
+        std::cin >> operand;
+        std::getline(std::cin, condition);
+        auto address = read_operand(operand);
+        Debugger::Breakpoint bp;
+        if (!address.second || !read_condition(condition, bp)) {
+            std::cerr << "Invalid breakpoint input\n";
+            return 1;
+        }
+        m.setBreakpoint(address.first, bp);
+        return 1;
+    }
+    else if (temp == "-watch") {
+        // Stop after a store to an address, or to the given number of words starting there
+        std::string operand, words;
+        std::cout << "Watch address: ";
+        std::cin >> operand;
+        std::getline(std::cin, words);
+        words.erase(std::remove_if(words.begin(), words.end(), ::isspace), words.end());
+        auto address = read_operand(operand);
+        auto count = words.empty() ? std::make_pair(1L, true) : read_operand(words);
+        if (!address.second || !count.second || count.first < 1 || address.first < 0 ||
+            address.first + count.first > (long)m.memory.size()) {
+            std::cerr << "Invalid watchpoint input\n";
+            return 1;
+        }
+        m.addWatchpoint(address.first, address.first + count.first - 1);
+        return 1;
+    }
+    else if (temp == "-delete") {
+        // Remove all breakpoints and watchpoints
+        m.clearDebug();
+        return 1;
+    }
+    else if (temp == "-run") {
+        return debugRun(m, 0);
+    }
+    else if (temp == "-until") {
+        // Run until PC reaches an address (or something else stops the run first)
+        std::string operand;
+        std::cout << "Run until address: ";
+        std::cin >> operand;
+        auto address = read_operand(operand);
+        if (!address.second) {
+            std::cerr << "Invalid address input\n";
+            return 1;
+        }
+        if (!m.debug.breakpoints.count(address.first)) {
+            Debugger::Breakpoint bp;
+            bp.temporary = true;
+            m.setBreakpoint(address.first, bp);
+        }
+        return debugRun(m, 0);
+    }
+    else if (temp == "-count") {
+        // Run at most the given number of instructions
+        std::string operand;
+        std::cout << "Instruction count: ";
+        std::cin >> operand;
+        auto count = read_operand(operand);
+        if (!count.second || count.first < 1) {
+            std::cerr << "Invalid count input\n";
+            return 1;
+        }
+        return debugRun(m, count.first);
+    }
     else {
         // Invalid input handling
         std::cerr << "Invalid emulator input" << std::endl;
         return 1;
     }
 }
-int main(int argc, char* argv[]) {
-    std::string machineCodeFile = (argc > 1) ? argv[1] : "machineCode_t5.O";
-    int tempData;
+// Snapshot file ("--snapshot"/"--resume"): header, page ranges, the program, then the non-zero pages of
+// guest memory, each range starting on a page boundary so it can be mapped straight back in
+struct SnapshotHeader {
+    char magic[8];        // "EMUSNAP1"
+    uint32_t pageBytes;   // Page size the snapshot was written with
+    uint32_t rangeCount;  // Entries of the range table that follows the header
+    int32_t regA, regB, PC, SP;
+    int64_t total;
+    uint32_t codeWords;   // Words of objectFile stored after the range table
+    uint32_t halted;      // Non-zero if the program had already reached HALT
+};
+
+// A run of consecutive saved pages
+struct SnapshotRange {
+    uint32_t firstPage;
+    uint32_t pageCount;
+    uint64_t offset;      // File offset of the first page
+};
+
+// Run at most count instructions like runSwitch(); returns EXIT_HALT if the program reached HALT and
+// EXIT_NONE if the count ran out first
+ExitReason runSteps(Machine &m, long long count) {
+    const DecodedInstr* code = m.decodedProgram.data();
+    for (long long step = 0; step < count; ++step) {
+        if ((unsigned)m.PC >= (unsigned)m.codeSize()) return EXIT_SEGFAULT;
+        int opcode = code[m.PC].opcode;
+        int operand = code[m.PC].operand;
+        if (opcode == HALT) {
+            m.total++;
+            return EXIT_HALT;
+        }
+        ExitReason reason = executeOpcode(m, opcode, operand);
+        if (reason != EXIT_NONE) return reason;
+        m.total++;
+        m.PC++;
+        if (m.SP > stackLimit) return EXIT_OVERFLOW;
+    }
+    return EXIT_NONE;
+}
+
+// Write the machine state to path; only pages that were touched and are not all zero are saved
+bool writeSnapshot(Machine &m, const string &path, bool halted) {
+    size_t pageBytes = sysconf(_SC_PAGESIZE);
+    size_t pageWords = pageBytes / sizeof(int);
+    size_t pageCount = m.memory.size() / pageWords;
+    // Every page is scanned: a page that is not resident may be swapped out rather than untouched, and reading
+    // one the guest never touched maps the shared zero page, which adds nothing to the resident set
+    vector<SnapshotRange> ranges;
+    for (size_t page = 0; page < pageCount; ++page) {
+        const int* words = m.memory.data() + page * pageWords;
+        if (all_of(words, words + pageWords, [](int word) { return word == 0; })) continue;
+        if (!ranges.empty() && ranges.back().firstPage + ranges.back().pageCount == page) {
+            ranges.back().pageCount++;
+        } else {
+            ranges.push_back({(uint32_t)page, 1, 0});
+        }
+    }
+    SnapshotHeader header = {{'E', 'M', 'U', 'S', 'N', 'A', 'P', '1'}, (uint32_t)pageBytes, (uint32_t)ranges.size(),
+                             m.regA, m.regB, m.PC, m.SP, m.total, (uint32_t)m.objectFile.size(), halted};
+    size_t offset = sizeof(header) + ranges.size() * sizeof(SnapshotRange) + m.objectFile.size() * sizeof(int);
+    offset = (offset + pageBytes - 1) / pageBytes * pageBytes;
+    for (auto &range : ranges) {
+        range.offset = offset;
+        offset += range.pageCount * pageBytes;
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    size_t position = sizeof(header);
+    size_t bytes = ranges.size() * sizeof(SnapshotRange);
+    ok = ok && pwrite(fd, ranges.data(), bytes, position) == (ssize_t)bytes;
+    position += bytes;
+    bytes = m.objectFile.size() * sizeof(int);
+    ok = ok && pwrite(fd, m.objectFile.data(), bytes, position) == (ssize_t)bytes;
+    for (const auto &range : ranges) {
+        bytes = range.pageCount * pageBytes;
+        ok = ok && pwrite(fd, m.memory.data() + range.firstPage * pageWords, bytes, range.offset) == (ssize_t)bytes;
+    }
+    ok = ok && ftruncate(fd, offset) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Load a snapshot written by writeSnapshot(): the program and registers are read, the saved pages are
+// mapped copy-on-write over guest m.memory (or read in when that is not possible)
+bool readSnapshot(Machine &m, const string &path, bool &halted) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    SnapshotHeader header;
+    bool ok = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+              && memcmp(header.magic, "EMUSNAP1", 8) == 0 && header.pageBytes % sizeof(int) == 0;
+    vector<SnapshotRange> ranges(ok ? header.rangeCount : 0);
+    size_t bytes = ranges.size() * sizeof(SnapshotRange);
+    ok = ok && pread(fd, ranges.data(), bytes, sizeof(header)) == (ssize_t)bytes;
+    if (ok) {
+        m.objectFile.assign(header.codeWords, 0);
+        size_t codeBytes = header.codeWords * sizeof(int);
+        ok = pread(fd, m.objectFile.data(), codeBytes, sizeof(header) + bytes) == (ssize_t)codeBytes;
+    }
+    size_t pageWords = ok ? header.pageBytes / sizeof(int) : 0;
+    bool canMap = ok && header.pageBytes % sysconf(_SC_PAGESIZE) == 0;
+    for (size_t i = 0; ok && i < ranges.size(); ++i) {
+        const SnapshotRange &range = ranges[i];
+        size_t firstWord = (size_t)range.firstPage * pageWords;
+        bytes = (size_t)range.pageCount * header.pageBytes;
+        if (firstWord + bytes / sizeof(int) > m.memory.size()) {
+            ok = false;
+        } else if (!(canMap && m.memory.mapFile(fd, range.offset, firstWord, bytes))) {
+            ok = pread(fd, m.memory.data() + firstWord, bytes, range.offset) == (ssize_t)bytes;
+        }
+    }
+    ::close(fd);  // The mappings keep the file alive
+    if (ok) {
+        m.regA = header.regA;
+        m.regB = header.regB;
+        m.PC = header.PC;
+        m.SP = header.SP;
+        m.total = header.total;
+        halted = header.halted != 0;
+    }
+    return ok;
+}
+
+// Run the loaded program once with each engine and report instructions per second
+void benchmark(Machine &m) {
+    using Clock = chrono::steady_clock;
+    ExitReason (*const engines[4])(Machine&) = {runSwitch, runThreaded, runBlocks, runJit};
+    const char* names[4] = {"switch", "threaded", "blocks", "jit"};
+    double seconds[4];
+    long long totals[4];
+    int states[4][5];
+    for (int e = 0; e < 4; ++e) {
+        m.reset();
+        auto start = Clock::now();
+        ExitReason reason = engines[e](m);
+        seconds[e] = chrono::duration<double>(Clock::now() - start).count();
+        totals[e] = m.total;
+        int state[5] = {m.regA, m.regB, m.PC, m.SP, reason};
+        copy(state, state + 5, states[e]);
+    }
+
+    printf("Instructions executed: %lld\n", m.total);
+    for (int e = 0; e < 4; ++e) {
+        printf("%-9s: %10.6f s  %10.2f MIPS\n", names[e], seconds[e], m.total / seconds[e] / 1e6);
+    }
+    printf("speedup  : %.2fx threaded, %.2fx blocks, %.2fx jit\n", seconds[0] / seconds[1],
+           seconds[0] / seconds[2], seconds[0] / seconds[3]);
+    // All engines must agree on the final machine state and on how the run ended
+    for (int e = 1; e < 4; ++e) {
+        if (totals[e] != totals[0] || !equal(states[0], states[0] + 5, states[e])) {
+            cout << "Engines disagree on the final state!" << endl;
+            exit(1);
+        }
+    }
+    exitOnError(static_cast<ExitReason>(states[0][4]));
+}
+
+// Run the loaded program to HALT with the given engine and no per-step output, then report the final state and speed.
+// The engine must keep to Machine::limit if runLimits are set
+void runBatch(ExitReason (*engine)(Machine&), Machine &m) {
+    long long before = m.total;  // Non-zero when resuming a snapshot
+    auto start = chrono::steady_clock::now();
+    ExitReason reason = runLimited(engine, m, runLimits);
+    exitOnLimit(m, reason);
+    exitOnError(reason);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    // Attempt to open the specified machine code file
-    std::ifstream currFile(machineCodeFile, std::ios::in | std::ios::binary);
-    if (!currFile) {
-        std::cerr << "Error opening file: " << machineCodeFile << std::endl;
+    printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", m.regA, m.regB, m.PC, m.SP);
+    printf("Total instructions executed: %lld\n", m.total);
+    printf("Wall time: %.6f s\n", seconds);
+    printf("MIPS: %.2f\n", seconds > 0 ? (m.total - before) / seconds / 1e6 : 0.0);
+}
+
+// Object files written by "asm" (see its ObjectHeader): the header, the code/data sections, the symbols,
+// the relocations and the name strings, followed by the program image. Only what loading needs is declared here
+struct ObjectHeader {
+    uint32_t magic, imageWords, sectionCount, symbolCount, relocationCount, stringBytes;
+};
+struct ObjectSection {
+    uint32_t kind, address, wordCount, offset;
+};
+struct ObjectSymbol {
+    uint32_t nameOffset, nameLength;
+    int32_t value;
+    uint32_t flags;
+};
+struct ObjectRelocation {
+    uint32_t address, kind;
+    int32_t symbol;
+};
+const uint32_t OBJECT_MAGIC = 0x314A424F;  // "OBJ1"
+const uint32_t SYMBOL_DEFINED = 1;
+
+// Place the sections of a mapped object into words. Every object is assembled at address 0, so its relocations
+// are already applied for loading there; only one with undefined symbols has to go through "asm --link" first
+bool loadObjectImage(const string &path, const char *data, size_t bytes, vector<int> &words) {
+    ObjectHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t symbolsAt = sizeof(header) + (size_t)header.sectionCount * sizeof(ObjectSection);
+    size_t stringsAt = symbolsAt + (size_t)header.symbolCount * sizeof(ObjectSymbol)
+                       + (size_t)header.relocationCount * sizeof(ObjectRelocation);
+    if (stringsAt + header.stringBytes > bytes || header.imageWords > GuestMemory::WORDS) {
+        cerr << "Corrupt object file: " << path << endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < header.symbolCount; ++i) {
+        ObjectSymbol symbol;
+        memcpy(&symbol, data + symbolsAt + i * sizeof(symbol), sizeof(symbol));
+        if (!(symbol.flags & SYMBOL_DEFINED)) {
+            string name(data + stringsAt + min<size_t>(symbol.nameOffset, header.stringBytes),
+                        min<size_t>(symbol.nameLength, header.stringBytes - min<size_t>(symbol.nameOffset, header.stringBytes)));
+            cerr << "Undefined symbol " << name << " in " << path << ": link it with asm --link" << endl;
+            return false;
+        }
+    }
+    words.assign(header.imageWords, 0);
+    for (uint32_t i = 0; i < header.sectionCount; ++i) {
+        ObjectSection section;
+        memcpy(&section, data + sizeof(header) + i * sizeof(section), sizeof(section));
+        if ((uint64_t)section.address + section.wordCount > header.imageWords
+            || (uint64_t)section.offset + (uint64_t)section.wordCount * sizeof(int) > bytes) {
+            cerr << "Corrupt object file: " << path << endl;
+            return false;
+        }
+        memcpy(words.data() + section.address, data + section.offset, section.wordCount * sizeof(int));
+    }
+    return true;
+}
+
+// Read a machine code file into words; returns false if it cannot be opened. The file is mapped and copied
+// in one piece: either an object written by "asm" or a bare image of words, as older assemblers wrote
+bool readObjectFile(const string &path, vector<int> &words) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        std::cerr << "Error opening file: " << path << std::endl;
+        return false;
+    }
+    size_t bytes = info.st_size;
+    const char *data = nullptr;
+    vector<char> buffer;  // Used when the file cannot be mapped (e.g. a pipe)
+    void *mapped = bytes ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mapped != MAP_FAILED) {
+        data = static_cast<const char*>(mapped);
+    } else {
+        char chunk[1 << 16];
+        ssize_t got;
+        while ((got = read(fd, chunk, sizeof(chunk))) > 0) buffer.insert(buffer.end(), chunk, chunk + got);
+        data = buffer.data();
+        bytes = buffer.size();
+    }
+    close(fd);
+    bool loaded = true;
+    uint32_t magic = 0;
+    if (bytes >= sizeof(ObjectHeader)) memcpy(&magic, data, sizeof(magic));
+    if (magic == OBJECT_MAGIC) {
+        loaded = loadObjectImage(path, data, bytes, words);
+    } else if (bytes / sizeof(int) > GuestMemory::WORDS) {
+        cerr << "Program does not fit in guest memory: " << path << endl;
+        loaded = false;
+    } else {
+        words.resize(bytes / sizeof(int));
+        if (!words.empty()) memcpy(words.data(), data, words.size() * sizeof(int));
+    }
+    if (mapped != MAP_FAILED) munmap(mapped, bytes);
+    return loaded;
+}
+
+// Ahead-of-time translation ("--aot"): the program becomes a C file with one label per basic block, which
+// the system compiler builds into a standalone executable that prints what --run prints. Blocks start at
+// address 0, at every static branch or call target and after every instruction that transfers control;
+// each adds its length to total on entry. return, whose target is only known at run time, goes through a
+// switch over the block labels. An address that starts no block, and any block a store has changed, runs in
+// an interpreter that is part of the generated file, so self-modifying code still behaves as it does in the
+// emulator. Stores that leave the word as it was (or hit data that is never run) cost one compare
+
+// C for one instruction that does not transfer control; k is its operand. codeStore runs after a store
+// whose address (addr) lies inside the program
+string translateInstruction(int opcode, const string &k, const string &codeStore) {
+    string spAddr = "addr = (uint32_t)sp + (uint32_t)(" + k + "); if (addr >= MEMORY_WORDS) BAD_SP(); ";
+    string aAddr = "addr = (uint32_t)a + (uint32_t)(" + k + "); if (addr >= MEMORY_WORDS) BAD_A(); ";
+    switch (opcode) {
+        case ldc: return "b = a; a = " + k + ";";
+        case adc: return "a = ADD(a, " + k + ");";
+        case ldl: return "b = a; " + spAddr + "a = mem[addr];";
+        case stl: return spAddr + "mem[addr] = a; a = b; if (addr < CODE_WORDS) " + codeStore;
+        case ldnl: return aAddr + "a = mem[addr];";
+        case stnl: return aAddr + "mem[addr] = b; if (addr < CODE_WORDS) " + codeStore;
+        case add: return "a = ADD(b, a);";
+        case sub: return "a = (int32_t)((uint32_t)b - (uint32_t)a);";
+        // Shift counts are taken modulo 32, as x86 (and so the emulator and the JIT) does
+        case shl: return "a = (int32_t)((uint32_t)b << (a & 31));";
+        case shr: return "a = b >> (a & 31);";
+        case adj: return "sp = ADD(sp, " + k + "); if (sp > STACK_LIMIT) STACK_OVERFLOW();";
+        case a2sp: return "sp = a; a = b; if (sp > STACK_LIMIT) STACK_OVERFLOW();";
+        case sp2a: return "b = a; a = sp;";
+        default: return "";
+    }
+}
+
+// Write outputPath.c for the program in words and build outputPath from it; returns false on failure
+bool translateAhead(const vector<int> &words, const string &sourceName, const string &outputPath) {
+    int size = words.size();
+    auto opcodeAt = [&](int pc) { return words[pc] & 0xFF; };
+    auto operandAt = [&](int pc) { return words[pc] >> 8; };
+    auto endsBlock = [](int opcode) { return opcode >= call || opcode > HALT; };
+    // Where a branch or call at pc goes (may lie outside the program)
+    auto targetOf = [&](int pc) {
+        return opcodeAt(pc) == call ? (long long)operandAt(pc) : (long long)pc + 1 + operandAt(pc);
+    };
+    vector<char> leader(size + 1, 0);
+    leader[0] = 1;
+    for (int pc = 0; pc < size; ++pc) {
+        int opcode = opcodeAt(pc);
+        if (endsBlock(opcode)) leader[pc + 1] = 1;
+        if (opcode == call || opcode == brz || opcode == brlz || opcode == br) {
+            long long target = targetOf(pc);
+            if (target >= 0 && target < size) leader[target] = 1;
+        }
+    }
+
+    string cPath = outputPath + ".c";
+    FILE* out = fopen(cPath.c_str(), "w");
+    if (!out) {
+        cerr << "Error writing " << cPath << endl;
+        return false;
+    }
+    fprintf(out, "// Translated from %s by emu --aot\n", sourceName.c_str());
+    fprintf(out, "#include <stdint.h>\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <time.h>\n\n");
+    fprintf(out, "#define CODE_WORDS %du\n#define MEMORY_WORDS %zuu\n#define STACK_LIMIT %d\n", size,
+            GuestMemory::WORDS, stackLimit);
+    fprintf(out, "#define ADD(x, y) ((int32_t)((uint32_t)(x) + (uint32_t)(y)))\n");
+    fprintf(out, "#define SEGFAULT() stop(\"Segmentation fault. Aborting.\\n\", 0)\n");
+    fprintf(out, "#define STACK_OVERFLOW() stop(\"Stack overflow. Aborting.\\n\", 0)\n");
+    fprintf(out, "#define BAD_SP() stop(\"Memory access error at SP + operand. Aborting.\", 1)\n");
+    fprintf(out, "#define BAD_A() stop(\"Memory access error at regA + operand. Aborting.\", 1)\n");
+    fprintf(out, "#define INVALID() stop(\"Invalid opcode. Incorrect machine code. Aborting.\\n\", 1)\n\n");
+    fprintf(out, "static const int32_t image[CODE_WORDS + 1] = {");
+    for (int pc = 0; pc < size; ++pc) fprintf(out, "%s%d,", pc % 8 ? " " : "\n    ", words[pc]);
+    fprintf(out, "\n    0};\nstatic const unsigned char leader[CODE_WORDS + 1] = {");
+    for (int pc = 0; pc < size; ++pc) fprintf(out, "%s%d,", pc % 32 ? "" : "\n    ", leader[pc]);
+    fprintf(out, "\n    0};\nstatic const int32_t blockOf[CODE_WORDS + 1] = {");
+    for (int pc = 0, block = 0; pc < size; ++pc) {
+        if (leader[pc]) block = pc;
+        fprintf(out, "%s%d,", pc % 16 ? " " : "\n    ", block);
+    }
+    fprintf(out, "\n    0};\n");
+    fprintf(out, "static unsigned char stale[CODE_WORDS + 1];  // Blocks whose words no longer match the image\n");
+    fprintf(out, "static int32_t mem[MEMORY_WORDS];\n\n");
+    fprintf(out, "static void stop(const char *message, int status) {\n    fputs(message, stdout);\n    exit(status);\n}\n\n");
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    int32_t a = 0, b = 0, sp = 0, pc = 0;\n");
+    fprintf(out, "    long long total = 0;\n");
+    fprintf(out, "    uint32_t addr;\n    struct timespec start, end;\n");
+    fprintf(out, "    memcpy(mem, image, sizeof(int32_t) * CODE_WORDS);\n");
+    fprintf(out, "    clock_gettime(CLOCK_MONOTONIC, &start);\n    goto dispatch;\n\n");
+
+    for (int begin = 0; begin < size; ) {
+        int end = begin + 1;
+        while (end < size && !endsBlock(opcodeAt(end - 1)) && !leader[end]) ++end;
+        int last = opcodeAt(end - 1);
+        int counted = end - begin - (last > HALT);  // An invalid opcode is not executed
+        fprintf(out, "B_%d:\n    if (stale[%d]) { pc = %d; goto interpret; }\n    total += %d;\n", begin, begin, begin, counted);
+        for (int pc = begin; pc < end; ++pc) {
+            int opcode = opcodeAt(pc), operand = operandAt(pc);
+            long long target = targetOf(pc);
+            string jump = (target >= 0 && target < size) ? "goto B_" + to_string(target) + ";" : "SEGFAULT();";
+            string line;
+            if (opcode < call) {
+                // A store that changed this block leaves for the interpreter, counting only what ran
+                string codeStore = "if (mem[addr] != image[addr]) { stale[blockOf[addr]] = 1; if (blockOf[addr] == " +
+                                   to_string(begin) + ") { total -= " + to_string(counted - (pc - begin + 1)) +
+                                   "; pc = " + to_string(pc + 1) + "; goto interpret; } }";
+                line = translateInstruction(opcode, to_string(operand), codeStore);
+            } else if (opcode == call) {
+                line = "b = a; a = " + to_string(pc) + "; " + jump;
+            } else if (opcode == ret) {
+                line = "pc = ADD(a, 1); a = b; goto dispatch;";
+            } else if (opcode == brz) {
+                line = "if (a == 0) " + jump;
+            } else if (opcode == brlz) {
+                line = "if (a < 0) " + jump;
+            } else if (opcode == br) {
+                line = jump;
+            } else if (opcode == HALT) {
+                line = "pc = " + to_string(pc) + "; goto halt;";
+            } else {
+                line = "INVALID();";
+            }
+            fprintf(out, "    %s  // %d: %s %d\n", line.c_str(), pc, opcode <= HALT ? mnemonics[opcode].c_str() : "?", operand);
+        }
+        // Running past the last word of the program
+        if (end == size && !(last == call || last == ret || last == br || last >= HALT)) fprintf(out, "    SEGFAULT();\n");
+        begin = end;
+    }
+
+    fprintf(out, "\ndispatch:\n    switch (pc) {\n");
+    for (int pc = 0; pc < size; ++pc) {
+        if (leader[pc]) fprintf(out, "        case %d: goto B_%d;\n", pc, pc);
+    }
+    fprintf(out, "        default: break;\n    }\n");
+    fprintf(out, "interpret:\n    for (;;) {\n");
+    fprintf(out, "        if ((uint32_t)pc >= CODE_WORDS) SEGFAULT();\n");
+    fprintf(out, "        if (leader[pc] && !stale[pc]) goto dispatch;\n");
+    fprintf(out, "        int32_t k = mem[pc] >> 8;\n");
+    fprintf(out, "        switch (mem[pc] & 0xFF) {\n");
+    for (int opcode = ldc; opcode < call; ++opcode) {
+        fprintf(out, "            case %d: %s break;\n", opcode, translateInstruction(opcode, "k", "if (mem[addr] != image[addr]) stale[blockOf[addr]] = 1;").c_str());
+    }
+    fprintf(out, "            case %d: b = a; a = pc; pc = k; ++total; continue;\n", call);
+    fprintf(out, "            case %d: pc = ADD(a, 1); a = b; ++total; continue;\n", ret);
+    fprintf(out, "            case %d: if (a == 0) pc = ADD(pc, k); break;\n", brz);
+    fprintf(out, "            case %d: if (a < 0) pc = ADD(pc, k); break;\n", brlz);
+    fprintf(out, "            case %d: pc = ADD(pc, k); break;\n", br);
+    fprintf(out, "            case %d: ++total; goto halt;\n", HALT);
+    fprintf(out, "            default: INVALID();\n        }\n        ++total;\n        ++pc;\n    }\n\n");
+    fprintf(out, "halt:\n    clock_gettime(CLOCK_MONOTONIC, &end);\n");
+    fprintf(out, "    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;\n");
+    fprintf(out, "    printf(\"A = %%08X, B = %%08X, PC = %%08X, SP = %%08X\\n\", a, b, pc, sp);\n");
+    fprintf(out, "    printf(\"Total instructions executed: %%lld\\n\", total);\n");
+    fprintf(out, "    printf(\"Wall time: %%.6f s\\n\", seconds);\n");
+    fprintf(out, "    printf(\"MIPS: %%.2f\\n\", seconds > 0 ? total / seconds / 1e6 : 0.0);\n");
+    fprintf(out, "    return 0;\n}\n");
+    bool written = !ferror(out);
+    if (fclose(out) != 0 || !written) {
+        cerr << "Error writing " << cPath << endl;
+        return false;
+    }
+
+    // Large programs give one very large function, which -O1 still compiles in reasonable time
+    const char* compiler = getenv("CC");
+    string command = string(compiler && *compiler ? compiler : "cc") + " -O1 -o '" + outputPath + "' '" + cPath + "'";
+    auto start = chrono::steady_clock::now();
+    if (system(command.c_str()) != 0) {
+        cerr << "Compiling failed: " << command << endl;
+        return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    int blocks = count(leader.begin(), leader.end() - 1, 1);
+    printf("%s: %d word(s), %d block(s), compiled in %.2f s\n", outputPath.c_str(), size, blocks, seconds);
+    return true;
+}
+
+// Count the opcode pairs and triples that occur inside basic blocks of the given object files and print the
+// most common ones; these are the candidates for the superinstructions of the block cache
+int mineNgrams(const vector<string> &files) {
+    const int TOP = 15;
+    map<vector<int>, long long> counts[2];  // Pairs, triples
+    for (const string &file : files) {
+        vector<int> words;
+        if (!readObjectFile(file, words)) return 1;
+        for (size_t i = 0; i < words.size(); ++i) {
+            // Only the last opcode of an n-gram may end a block
+            vector<int> gram;
+            for (size_t j = i; j < words.size() && gram.size() < 3; ++j) {
+                int opcode = words[j] & 0xFF;
+                if (opcode > HALT) break;
+                gram.push_back(opcode);
+                if (gram.size() >= 2) counts[gram.size() - 2][gram]++;
+                if (opcode == call || opcode == ret || opcode == brz || opcode == brlz || opcode == br
+                    || opcode == HALT) break;
+            }
+        }
+    }
+    const char* titles[2] = {"Pairs", "Triples"};
+    for (int n = 0; n < 2; ++n) {
+        vector<pair<long long, vector<int>>> sorted;
+        for (auto &entry : counts[n]) sorted.push_back({entry.second, entry.first});
+        stable_sort(sorted.begin(), sorted.end(), [](const auto &x, const auto &y) { return x.first > y.first; });
+        printf("%s:\n", titles[n]);
+        for (int i = 0; i < (int)sorted.size() && i < TOP; ++i) {
+            printf("%8lld ", sorted[i].first);
+            for (int opcode : sorted[i].second) printf(" %s", mnemonics[opcode].c_str());
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+// Thread pool for --farm. Every thread owns a deque of job numbers: it runs its own from the back and,
+// once that is empty, steals from the front of the others, so a few long programs do not leave threads idle
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threadCount) : queues(max(1, threadCount)) {}
+    int size() const { return queues.size(); }
+    // Call job(0) ... job(jobCount - 1) across the threads and wait for all of them; the caller is thread 0
+    void run(int jobCount, const function<void(int)> &job) {
+        for (int i = 0; i < jobCount; ++i) queues[i % queues.size()].jobs.push_back(i);
+        vector<thread> threads;
+        for (int self = 1; self < size(); ++self) threads.emplace_back([&, self] { work(self, job); });
+        work(0, job);
+        for (auto &worker : threads) worker.join();
+    }
+
+private:
+    struct Queue {
+        mutex guard;      // Protects jobs
+        deque<int> jobs;
+    };
+    vector<Queue> queues;
+
+    void work(int self, const function<void(int)> &job) {
+        // No jobs are added once the run started, so all queues being empty means the work is done
+        int next;
+        while (take(self, true, next) || steal(self, next)) job(next);
+    }
+    bool take(int queue, bool own, int &next) {
+        lock_guard<mutex> lock(queues[queue].guard);
+        deque<int> &jobs = queues[queue].jobs;
+        if (jobs.empty()) return false;
+        if (own) {
+            next = jobs.back();
+            jobs.pop_back();
+        } else {
+            next = jobs.front();
+            jobs.pop_front();
+        }
+        return true;
+    }
+    bool steal(int self, int &next) {
+        for (int i = 1; i < size(); ++i) {
+            if (take((self + i) % size(), false, next)) return true;
+        }
+        return false;
+    }
+};
+
+// One program run of a farm and how it ended
+struct FarmResult {
+    string file;
+    long long sweepValue = 0;   // Value stored at the sweep address (only with --sweep)
+    string exitName;            // exitNames[] entry, or "unreadable"
+    int regA = 0, regB = 0, PC = 0, SP = 0;
+    long long total = 0;
+    double seconds = 0;
+};
+
+// Write the results as CSV (header line, one row per run) or as a JSON array of objects
+void writeFarmReport(ostream &out, const vector<FarmResult> &results, bool json, bool sweep) {
+    char registers[64];
+    if (json) out << "[\n";
+    else out << "file," << (sweep ? "sweep," : "") << "exit,A,B,PC,SP,instructions,seconds\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const FarmResult &r = results[i];
+        if (json) {
+            // File names are written as given; only quotes and backslashes need escaping
+            string file;
+            for (char c : r.file) {
+                if (c == '"' || c == '\\') file += '\\';
+                file += c;
+            }
+            snprintf(registers, sizeof(registers), "\"A\": %d, \"B\": %d, \"PC\": %d, \"SP\": %d", r.regA, r.regB,
+                     r.PC, r.SP);
+            out << "  {\"file\": \"" << file << "\", ";
+            if (sweep) out << "\"sweep\": " << r.sweepValue << ", ";
+            out << "\"exit\": \"" << r.exitName << "\", " << registers << ", \"instructions\": " << r.total
+                << ", \"seconds\": " << r.seconds << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        } else {
+            snprintf(registers, sizeof(registers), "%08X,%08X,%08X,%08X", r.regA, r.regB, r.PC, r.SP);
+            out << r.file << "," << (sweep ? to_string(r.sweepValue) + "," : "") << r.exitName << ","
+                << registers << "," << r.total << "," << r.seconds << "\n";
+        }
+    }
+    if (json) out << "]\n";
+}
+
+// "--farm": run every object file (once per sweep value with --sweep) on its own Machine with runBlocks(),
+// spread over a work-stealing pool, and collect how each run ended into one report.
+// With "--slice N" all machines are kept on the calling thread instead and take turns of N instructions,
+// so a program that never halts only holds up the others until --budget or --deadline stops it.
+// Returns 1 if any run did not reach HALT
+int runFarm(int argc, char* argv[]) {
+    vector<string> files;
+    int threadCount = max(1u, thread::hardware_concurrency());
+    string csvPath, jsonPath;
+    bool sweep = false;
+    long long sweepAddress = 0, sweepFrom = 0, sweepTo = 0;
+    long long slice = 0;
+    RunLimits limits;
+    for (int i = 2; i < argc; ++i) {
+        string option = argv[i];
+        if (readRunLimit(argc, argv, i, limits)) continue;
+        if (option == "-j" && i + 1 < argc) threadCount = max(1, atoi(argv[++i]));
+        else if (option == "--slice" && i + 1 < argc) slice = max(1LL, atoll(argv[++i]));
+        else if (option == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (option == "--json" && i + 1 < argc) jsonPath = argv[++i];
+        else if (option == "--sweep" && i + 1 < argc) {
+            // "ADDR:FROM:TO" stores each value FROM..TO (inclusive) at memory[ADDR] before the program starts
+            sweep = sscanf(argv[++i], "%lli:%lli:%lli", &sweepAddress, &sweepFrom, &sweepTo) == 3;
+            if (!sweep || sweepAddress < 0 || sweepAddress >= (long long)GuestMemory::WORDS || sweepTo < sweepFrom) {
+                std::cerr << "Invalid sweep: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (option[0] == '-') {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+        else files.push_back(option);
+    }
+    if (files.empty()) {
+        std::cerr << "Usage: emu --farm <files...> [-j N] [--sweep ADDR:FROM:TO] [--csv <out>] [--json <out>]"
+                  << " [--slice N] [--budget N] [--deadline SECONDS]" << std::endl;
         return 1;
     }
 
-    // Read the binary file into the objectFile vector
-    while (currFile.read(reinterpret_cast<char*>(&tempData), sizeof(int))) {
-        objectFile.push_back(tempData);
+    // Every program is read once; the jobs copy it into their own machine
+    vector<vector<int>> programs(files.size());
+    vector<char> readable(files.size());
+    for (size_t f = 0; f < files.size(); ++f) readable[f] = readObjectFile(files[f], programs[f]);
+    long long runsPerFile = sweep ? sweepTo - sweepFrom + 1 : 1;
+    vector<FarmResult> results(files.size() * runsPerFile);
+
+    // Load the machine of a job; false if its file could not be read
+    auto prepare = [&](int job, Machine &machine) {
+        FarmResult &result = results[job];
+        size_t f = job / runsPerFile;
+        result.file = files[f];
+        result.sweepValue = sweepFrom + job % runsPerFile;
+        if (!readable[f]) {
+            result.exitName = "unreadable";
+            return false;
+        }
+        machine.load(programs[f]);
+        if (sweep) machine.store(sweepAddress, result.sweepValue);  // Through store() so a swept code word is decoded again
+        return true;
+    };
+    auto finish = [&](int job, const Machine &machine, ExitReason reason) {
+        FarmResult &result = results[job];
+        result.exitName = exitNames[reason];
+        result.regA = machine.regA;
+        result.regB = machine.regB;
+        result.PC = machine.PC;
+        result.SP = machine.SP;
+        result.total = machine.total;
+    };
+
+    auto start = chrono::steady_clock::now();
+    WorkStealingPool pool(slice ? 1 : threadCount);
+    if (slice) {
+        // Round robin over the machines still running; each turn is one runSlice()
+        vector<unique_ptr<Machine>> machines(results.size());
+        vector<int> running;
+        for (int job = 0; job < (int)results.size(); ++job) {
+            machines[job] = make_unique<Machine>();
+            if (prepare(job, *machines[job])) running.push_back(job);
+        }
+        while (!running.empty()) {
+            vector<int> next;
+            for (int job : running) {
+                ExitReason reason = runSlice(runBlocks, *machines[job], limits, slice, results[job].seconds);
+                if (reason == EXIT_COUNT) {
+                    next.push_back(job);
+                } else {
+                    finish(job, *machines[job], reason);
+                    machines[job].reset();
+                }
+            }
+            running.swap(next);
+        }
+    } else {
+        pool.run(results.size(), [&](int job) {
+            Machine machine;
+            if (!prepare(job, machine)) return;
+            auto runStart = chrono::steady_clock::now();
+            ExitReason reason = runLimited(runBlocks, machine, limits);
+            results[job].seconds = chrono::duration<double>(chrono::steady_clock::now() - runStart).count();
+            finish(job, machine, reason);
+        });
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Without --csv or --json the CSV report goes to stdout
+    if (csvPath.empty() && jsonPath.empty()) writeFarmReport(cout, results, false, sweep);
+    for (const auto &report : {make_pair(csvPath, false), make_pair(jsonPath, true)}) {
+        if (report.first.empty()) continue;
+        ofstream out(report.first);
+        if (!out) {
+            std::cerr << "Error writing report: " << report.first << std::endl;
+            return 1;
+        }
+        writeFarmReport(out, results, report.second, sweep);
+    }
+    long long halted = 0, instructions = 0;
+    for (const FarmResult &result : results) {
+        halted += result.exitName == exitNames[EXIT_HALT];
+        instructions += result.total;
+    }
+    fprintf(stderr, "%lld of %zu run(s) halted, %lld instructions, %.3f s, %.2f MIPS, %d thread(s)\n", halted,
+            results.size(), instructions, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0, pool.size());
+    return halted == (long long)results.size() ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    // "--run <file>" executes silently to HALT, "--jit <file>" does the same with the JIT,
+    // "--bench <file>" times the engines against each other, "--ngrams <files...>" counts opcode pairs and
+    // triples for choosing superinstructions, "--profile <file> [--lst <listing>] [--folded <out>]" runs like
+    // --run and reports where the time went, "--trace <file> [--out <trace>] [--ring N]" runs like --run and
+    // records a binary trace, "--decode-trace <trace> [--pc LO:HI] [--window FROM:TO]" prints a trace in the
+    // -all format, "--snapshot <file> <snapshot> [N]" runs N instructions (default: to HALT) and saves the
+    // machine, "--resume <snapshot>" continues a saved machine to HALT, "--farm <files...> [-j N]
+    // [--sweep ADDR:FROM:TO] [--csv <out>] [--json <out>] [--slice N]" runs many programs in parallel and reports
+    // on each, "--aot <file> <output>" translates the program to C and builds it into a native executable with
+    // $CC (default cc); without a mode flag the interactive prompt is started.
+    // --run, --jit, --resume, --farm and the prompt's -all also take "--budget N" and "--deadline SECONDS"
+    string mode = (argc > 1 && argv[1][0] == '-' && argv[1][1] == '-') ? argv[1] : "";
+    if (mode == "--ngrams") {
+        return mineNgrams(vector<string>(argv + 2, argv + argc));
+    }
+    if (mode == "--farm") {
+        return runFarm(argc, argv);
+    }
+    if (mode == "--aot") {
+        if (argc < 4) {
+            std::cerr << "Usage: emu --aot <file> <output>" << std::endl;
+            return 1;
+        }
+        vector<int> words;
+        if (!readObjectFile(argv[2], words)) return 1;
+        return translateAhead(words, argv[2], argv[3]) ? 0 : 1;
+    }
+    // Static so the machine outlives the exit handlers the profiler and tracer register
+    static Machine machine;
+    if (mode == "--decode-trace") {
+        if (argc < 3) {
+            std::cerr << "Usage: emu --decode-trace <trace> [--pc LO:HI] [--window FROM:TO]" << std::endl;
+            return 1;
+        }
+        // Ranges are "LO:HI" (PCs, inclusive, decimal or 0x hex) and "FROM:TO" (instruction numbers, TO excluded)
+        long long pcFrom = 0, pcTo = LLONG_MAX;
+        unsigned long long from = 0, to = ULLONG_MAX;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string option = argv[i], range = argv[i + 1];
+            size_t colon = range.find(':');
+            if (colon == string::npos || (option != "--pc" && option != "--window")) {
+                std::cerr << "Invalid option: " << option << " " << range << std::endl;
+                return 1;
+            }
+            string low = range.substr(0, colon), high = range.substr(colon + 1);
+            if (option == "--pc") {
+                if (!low.empty()) pcFrom = stoll(low, nullptr, 0);
+                if (!high.empty()) pcTo = stoll(high, nullptr, 0);
+            } else {
+                if (!low.empty()) from = stoull(low, nullptr, 0);
+                if (!high.empty()) to = stoull(high, nullptr, 0);
+            }
+        }
+        return decodeTrace(argv[2], pcFrom, pcTo, from, to);
+    }
+    if (mode == "--resume") {
+        if (argc < 3) {
+            std::cerr << "Usage: emu --resume <snapshot>" << std::endl;
+            return 1;
+        }
+        for (int i = 3; i < argc; ++i) {
+            if (!readRunLimit(argc, argv, i, runLimits)) {
+                std::cerr << "Unknown option: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        auto start = chrono::steady_clock::now();
+        bool halted = false;
+        if (!readSnapshot(machine, argv[2], halted)) {
+            std::cerr << "Error reading snapshot: " << argv[2] << std::endl;
+            return 1;
+        }
+        machine.decodeProgram();
+        printf("Snapshot restored in %.3f ms\n",
+               chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        // A machine saved at HALT has nothing left to run
+        runBatch(halted ? [](Machine&) { return EXIT_HALT; } : runBlocks, machine);
+        return 0;
+    }
+    bool benchMode = (mode == "--bench");
+    bool jitMode = (mode == "--jit");
+    bool profileMode = (mode == "--profile");
+    bool traceMode = (mode == "--trace");
+    bool snapshotMode = (mode == "--snapshot");
+    bool runMode = (mode == "--run" || jitMode || profileMode || traceMode || snapshotMode);
+    if (!mode.empty() && !benchMode && !runMode) {
+        std::cerr << "Unknown option: " << mode << std::endl;
+        return 1;
+    }
+    int fileArg = mode.empty() ? 1 : 2;
+    std::string machineCodeFile = (argc > fileArg) ? argv[fileArg] : "machineCode_t5.O";
+    if (mode == "--run" || jitMode || mode.empty()) {
+        for (int i = fileArg + 1; i < argc; ++i) {
+            if (!readRunLimit(argc, argv, i, runLimits)) {
+                std::cerr << "Unknown option: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
     }
-    currFile.close();
 
-    // Load objectFile data into mainMemory
-    for (size_t i = 0; i < objectFile.size(); ++i) {
-        memory[i] = objectFile[i];
+    // Read the binary file, load it at address 0 and decode it once up front
+    vector<int> words;
+    if (!readObjectFile(machineCodeFile, words)) {
+        return 1;
+    }
+    machine.load(move(words));
+
+    if (benchMode) {
+        benchmark(machine);
+        return 0;
+    }
+    if (profileMode) {
+        // The listing defaults to the one asm writes next to the object file, else listfile.lst
+        string base = machineCodeFile.substr(0, machineCodeFile.rfind('.'));
+        profiler.listingPath = ifstream(base + ".lst") ? base + ".lst" : "listfile.lst";
+        for (int i = fileArg + 1; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            if (option == "--lst") profiler.listingPath = argv[i + 1];
+            else if (option == "--folded") profiler.foldedPath = argv[i + 1];
+            else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+        profiler.reset(machine);
+        atexit([] { profiler.report(); });  // Also reports runs that abort
+        runBatch(runProfiled, machine);
+        return 0;
+    }
+    if (snapshotMode) {
+        if (argc <= fileArg + 1) {
+            std::cerr << "Usage: emu --snapshot <file> <snapshot> [instructions]" << std::endl;
+            return 1;
+        }
+        string snapshotPath = argv[fileArg + 1];
+        long long count = (argc > fileArg + 2) ? stoll(argv[fileArg + 2]) : LLONG_MAX;
+        ExitReason reason = runSteps(machine, count);
+        exitOnError(reason);
+        bool halted = (reason == EXIT_HALT);
+        if (!writeSnapshot(machine, snapshotPath, halted)) {
+            std::cerr << "Error writing snapshot: " << snapshotPath << std::endl;
+            return 1;
+        }
+        printf("A = %08X, B = %08X, PC = %08X, SP = %08X\n", machine.regA, machine.regB, machine.PC, machine.SP);
+        printf("Snapshot after %lld instructions%s written to %s\n", machine.total, halted ? " (halted)" : "",
+               snapshotPath.c_str());
+        return 0;
+    }
+    if (traceMode) {
+        string tracePath = "trace.bin";
+        size_t ringSize = 0;
+        for (int i = fileArg + 1; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            if (option == "--out") tracePath = argv[i + 1];
+            else if (option == "--ring") ringSize = stoull(argv[i + 1]);
+            else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+        if (!traceWriter.open(tracePath, ringSize)) {
+            std::cerr << "Error opening trace: " << tracePath << std::endl;
+            return 1;
+        }
+        atexit([] { traceWriter.close(); });  // Keeps the trace of runs that abort
+        runBatch(runTraced, machine);
+        return 0;
+    }
+    if (runMode) {
+        runBatch(jitMode ? runJit : runBlocks, machine);
+        return 0;
     }
 
     // Display user instructions
@@ -331,12 +3053,14 @@ int main(int argc, char* argv[]) {
               << "-t for trace\n"
               << "-dump for memory dump\n"
               << "-all for executing all commands\n"
+              << "-break <pc> [A|B|SP <op> value] to set a breakpoint, -watch <addr> [words] to watch stores,\n"
+              << "-delete to remove them, -run, -until <pc> or -count <n> to run to the next stop\n"
               << "Enter commands with hyphen:\n";
 
     // Emulator input loop
-    while (advance()) {
+    while (advance(machine)) {
         // Continue prompting until advance() returns 0
     }
-    std::cout << "Total instructions executed: " << total << std::endl;
+    std::cout << "Total instructions executed: " << machine.total << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+# Run random programs from randprog.py with emu --run, --jit and --bench and check that the engines agree on
+# what they print and on the exit code. A program they disagree on is kept as mismatch-<seed>.o in the
+# current directory, to be run again by hand.
+#
+#   tools/jitcheck.sh [EMU] [COUNT] [FIRST_SEED]
+#
+# EMU defaults to ./emu, COUNT to 400 and FIRST_SEED to 1. --run and --jit get an instruction budget so a
+# program that never halts stops at the same instruction in both; --bench has no budget and only runs the
+# programs that finished within it. The timings (Wall time, MIPS, the per-engine lines of --bench) are left
+# out of the comparison.
+
+emu=${1:-./emu}
+count=${2:-400}
+first=${3:-1}
+budget=2000000
+tools=$(dirname "$0")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Output of a run without its timings, followed by its exit code
+run() {
+    # In a subshell, so a crash is reported only through the exit code and not by the shell as well
+    (timeout -s KILL 60 "$emu" "$@" >"$work/out" 2>&1; exit $?) 2>/dev/null
+    local status=$?
+    grep -av -e '^Wall time:' -e '^MIPS:' -e '^\(switch\|threaded\|blocks\|jit\) *:' -e '^speedup' "$work/out"
+    echo "exit $status"
+}
+
+mismatches=0
+for ((seed = first; seed < first + count; ++seed)); do
+    python3 "$tools/randprog.py" "$seed" "$work/p.o" || exit 1
+    expected=$(run --run "$work/p.o" --budget $budget)
+    jit=$(run --jit "$work/p.o" --budget $budget)
+    bench= reference=
+    # --bench checks the four engines against each other itself; it prints how the run ended but no registers
+    if [[ $expected != *"exit 124" && $expected != *"exit 137" ]]; then
+        bench=$(run --bench "$work/p.o" | grep -v '^Instructions executed:')
+        reference=$(grep -v -e '^A = ' -e '^Total instructions executed:' <<<"$expected")
+    fi
+    if [[ $jit != "$expected" || $bench != "$reference" ]]; then
+        ((++mismatches))
+        cp "$work/p.o" "mismatch-$seed.o"
+        echo "seed $seed:"
+        diff <(echo "$expected") <(echo "$jit") | sed 's/^/  jit   /'
+        [[ -n $bench ]] && diff <(echo "$reference") <(echo "$bench") | sed 's/^/  bench /'
+    fi
+done
+echo "$count program(s), $mismatches mismatch(es)"
+((mismatches == 0))
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+# Random programs for checking the engines of emu against each other (see jitcheck.sh). The output is raw
+# machine words, which emu loads like an object file without a header.
+#
+#   randprog.py SEED OUTPUT
+#
+# The seed picks one of three kinds of program:
+#   words     random instruction words, faults and invalid opcodes included
+#   selfmod   a loop whose body builds instruction words and stores them over itself, ahead of the running
+#             instruction and behind it, with stnl and with stl while SP points into the program
+#   straight  one long run of stack loads and stores that spans several JIT blocks, sometimes only stl
+# selfmod and straight programs end by adding up the words they may have written, so the final A shows
+# a store that went wrong even when every engine halts in the same place
+
+import random
+import struct
+import sys
+
+LDC, ADC, LDL, STL, LDNL, STNL, ADD, SUB, SHL, SHR, ADJ, A2SP, SP2A, CALL, RET, BRZ, BRLZ, BR, HALT = range(19)
+
+DATA = 5000      # Loop counter and stnl scratch words of selfmod and straight programs
+STACK = 20000    # SP while a program is not deliberately storing into itself
+
+
+def word(opcode, operand=0):
+    return ((operand & 0xFFFFFF) << 8) | opcode
+
+
+def random_words(rng):
+    n = rng.randint(1, 40)
+    program = []
+    for _ in range(n):
+        opcode = rng.choice(list(range(19)) + [LDC, ADC, LDL, STL, BRZ, BRLZ, BR, CALL, RET, ADJ, ADJ, A2SP, 19])
+        if opcode in (BRZ, BRLZ, BR):
+            operand = rng.randint(-n, n)
+        elif opcode == CALL:
+            operand = rng.randint(0, n)
+        elif opcode in (LDL, STL, LDNL, STNL):
+            operand = rng.randint(-3, 40)
+        elif opcode == ADJ:
+            operand = rng.randint(-5, 200)
+        else:
+            operand = rng.randint(-50, 50)
+        program.append(word(opcode, operand))
+    return program
+
+
+# A plain instruction that keeps SP and the control flow as they are, for filling and for patching in
+def plain(rng):
+    opcode = rng.choice([LDC, ADC, ADD, SUB, SHL, SHR, LDL, STL, SP2A])
+    if opcode in (LDL, STL):
+        return word(opcode, rng.randint(0, 8))
+    if opcode in (SHL, SHR):
+        return word(opcode)
+    return word(opcode, rng.randint(-300, 300))
+
+
+# Sum the words at addresses into A, then HALT
+def epilogue(addresses):
+    code = [word(LDC, 0)]
+    for address in addresses:
+        code += [word(LDC, address), word(LDNL, 0), word(ADD)]
+    return code + [word(HALT)]
+
+
+# ldc/ldc 8/shl/adc leave the instruction word w in A (ldc sign-extends, and shl drops those bits again)
+def build(w):
+    return [word(LDC, w >> 8), word(LDC, 8), word(SHL), word(ADC, w & 0xFF)]
+
+
+def self_modifying(rng):
+    program = [word(LDC, STACK), word(A2SP), word(LDC, rng.randint(1, 6)), word(LDC, DATA), word(STNL, 0)]
+    loop = len(program)
+    size = rng.randint(12, 60)
+    body = [None] * size  # Patches are placed first, then the remaining slots are filled
+    patched = set()
+    for _ in range(rng.randint(1, 4)):
+        if rng.random() < 0.7:
+            # Store the new word with stnl
+            store = [word(LDC, 0), word(STNL, 0)]
+        else:
+            # Point SP at the target and store it with stl, then put SP back
+            store = [word(LDC, 0), word(A2SP), word(STL, 0), word(LDC, STACK), word(A2SP)]
+        length = 4 + len(store)
+        at = rng.randint(0, size - length)
+        if any(body[at + k] is not None for k in range(length)):
+            continue
+        # Anywhere in the body but the patch itself: ahead of it in the same block or behind it
+        target = rng.choice([t for t in range(size) if not at <= t < at + length])
+        store[0] = word(LDC, loop + target)
+        body[at:at + length] = build(plain(rng)) + store
+        patched.add(loop + target)
+    program += [w if w is not None else plain(rng) for w in body]
+    # Count down the loop counter and go round again while it is not zero
+    program += [word(LDC, DATA), word(LDNL, 0), word(ADC, -1), word(LDC, DATA), word(STNL, 0),
+                word(LDC, DATA), word(LDNL, 0)]
+    exit_branch = len(program)
+    program += [0, word(BR, loop - (len(program) + 2))]
+    program[exit_branch] = word(BRZ, len(program) - (exit_branch + 1))
+    return program + epilogue(sorted(patched) + [DATA, STACK])
+
+
+def straight(rng):
+    # Some keep the stack over the start of the program, which has already run, so stl stores into it
+    stack = rng.choice([STACK, 0])
+    program = [word(LDC, stack), word(A2SP)]
+    program += [word(ADC, 0)] * rng.randint(0, 1100)  # Moves where the JIT's block boundaries fall
+    # Some are nothing but stl, the most code per instruction the JIT emits
+    mix = 0.4 if rng.random() < 0.3 else 1.0
+    for _ in range(rng.randint(500, 3000)):
+        kind = rng.random() * mix
+        if kind < 0.4:
+            program.append(word(STL, rng.randint(0, 15)))
+        elif kind < 0.6:
+            program.append(word(LDL, rng.randint(0, 15)))
+        elif kind < 0.8:
+            program += [word(LDC, DATA), word(STNL, rng.randint(0, 15))]
+        elif kind < 0.9:
+            program += [word(LDC, DATA), word(LDNL, rng.randint(0, 15))]
+        else:
+            program.append(word(ADC, rng.randint(-1000, 1000)))
+    return program + epilogue([stack + k for k in range(16)] + [DATA + k for k in range(16)])
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("Usage: randprog.py SEED OUTPUT")
+    rng = random.Random(int(sys.argv[1]))
+    kind = rng.choice([random_words, random_words, self_modifying, self_modifying, straight])
+    with open(sys.argv[2], "wb") as out:
+        out.write(b"".join(struct.pack("<I", w) for w in kind(rng)))
+
+
+if __name__ == "__main__":
+    main()